@@ -0,0 +1,259 @@
+#include "capture.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t crcTable[256];
+
+static void capture_initializeCrcTable() {
+    for ( uint32_t i = 0; i < 256; ++i ) {
+        uint32_t crc = i;
+        for ( int j = 0; j < 8; ++j ) {
+            crc = crc & 1 ? 0xEDB88320 ^ ( crc >> 1 ) : crc >> 1;
+        }
+        crcTable[i] = crc;
+    }
+}
+
+static uint32_t capture_crc( uint32_t crc, const uint8_t *data, size_t length ) {
+    for ( size_t i = 0; i < length; ++i ) {
+        crc = crcTable[( crc ^ data[i] ) & 0xFF] ^ ( crc >> 8 );
+    }
+    return crc;
+}
+
+static void capture_putBigEndian( uint8_t *dest, uint32_t value ) {
+    dest[0] = value >> 24;
+    dest[1] = value >> 16;
+    dest[2] = value >> 8;
+    dest[3] = value;
+}
+
+static void capture_writeChunk( FILE *file, const char type[4],
+                                const uint8_t *data, uint32_t length ) {
+    uint8_t header[8];
+    capture_putBigEndian( header, length );
+    memcpy( header + 4, type, 4 );
+    uint32_t crc = capture_crc( 0xFFFFFFFF, header + 4, 4 );
+    crc = capture_crc( crc, data, length ) ^ 0xFFFFFFFF;
+    uint8_t footer[4];
+    capture_putBigEndian( footer, crc );
+    fwrite( header, 1, 8, file );
+    fwrite( data, 1, length, file );
+    fwrite( footer, 1, 4, file );
+}
+
+/*
+ * Write a frame as a 1-bit indexed PNG. The image data is small enough
+ * (DISPLAY_HEIGHT * (1 + DISPLAY_ROW_BYTES) bytes) to go in a single stored,
+ * uncompressed deflate block, so no zlib is needed.
+ */
+static void capture_writePng( struct Capture *capture, const struct CaptureFrame *frame,
+                              uint64_t frameNumber ) {
+    char path[4096];
+    snprintf( path, sizeof( path ), "%s/frame_%08llu.png", capture->pngDirectory,
+              ( unsigned long long ) frameNumber );
+    FILE *file = fopen( path, "wb" );
+    if ( !file ) {
+        fprintf( stderr, "Could not open %s for writing\n", path );
+        return;
+    }
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite( signature, 1, 8, file );
+
+    uint8_t header[13] = { 0 };
+    capture_putBigEndian( header, DISPLAY_WIDTH );
+    capture_putBigEndian( header + 4, DISPLAY_HEIGHT );
+    header[8] = 1; //bit depth
+    header[9] = 3; //indexed color
+    capture_writeChunk( file, "IHDR", header, sizeof( header ) );
+
+    const uint8_t palette[6] = {
+        ( BACKGROUND_COLOR >> 16 ) & 0xFF, ( BACKGROUND_COLOR >> 8 ) & 0xFF,
+        BACKGROUND_COLOR & 0xFF,
+        ( PIXEL_COLOR >> 16 ) & 0xFF, ( PIXEL_COLOR >> 8 ) & 0xFF,
+        PIXEL_COLOR & 0xFF
+    };
+    capture_writeChunk( file, "PLTE", palette, sizeof( palette ) );
+
+    enum { RAW_BYTES = DISPLAY_HEIGHT * ( 1 + DISPLAY_ROW_BYTES ) };
+    uint8_t data[2 + 5 + RAW_BYTES + 4];
+    uint8_t *raw = data + 7;
+    data[0] = 0x78; //deflate, 32K window
+    data[1] = 0x01; //no preset dictionary, header checksum
+    data[2] = 0x01; //final block, stored
+    data[3] = RAW_BYTES & 0xFF;
+    data[4] = RAW_BYTES >> 8;
+    data[5] = ~RAW_BYTES & 0xFF;
+    data[6] = ( ~RAW_BYTES >> 8 ) & 0xFF;
+    for ( int y = 0; y < DISPLAY_HEIGHT; ++y ) {
+        raw[y * ( 1 + DISPLAY_ROW_BYTES )] = 0; //no filter
+        memcpy( raw + y * ( 1 + DISPLAY_ROW_BYTES ) + 1, frame->pixels[y],
+                DISPLAY_ROW_BYTES );
+    }
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for ( int i = 0; i < RAW_BYTES; ++i ) {
+        a = ( a + raw[i] ) % 65521;
+        b = ( b + a ) % 65521;
+    }
+    capture_putBigEndian( raw + RAW_BYTES, b << 16 | a );
+    capture_writeChunk( file, "IDAT", data, sizeof( data ) );
+    capture_writeChunk( file, "IEND", NULL, 0 );
+    fclose( file );
+}
+
+static void capture_writeY4m( struct Capture *capture, const struct CaptureFrame *frame ) {
+    //full range luma, neutral chroma, 4:2:0
+    uint8_t plane[DISPLAY_WIDTH * DISPLAY_HEIGHT + DISPLAY_WIDTH * DISPLAY_HEIGHT / 2];
+    for ( int y = 0; y < DISPLAY_HEIGHT; ++y ) {
+        for ( int x = 0; x < DISPLAY_WIDTH; ++x ) {
+            bool lit = ( frame->pixels[y][x / 8] >> ( 7 - x % 8 ) ) & 1;
+            plane[y * DISPLAY_WIDTH + x] = lit ? 255 : 0;
+        }
+    }
+    memset( plane + DISPLAY_WIDTH * DISPLAY_HEIGHT, 128,
+            DISPLAY_WIDTH * DISPLAY_HEIGHT / 2 );
+    for ( uint32_t i = 0; i < frame->repeat; ++i ) {
+        fputs( "FRAME\n", capture->y4mFile );
+        fwrite( plane, 1, sizeof( plane ), capture->y4mFile );
+    }
+}
+
+static void capture_writeFrame( struct Capture *capture, const struct CaptureFrame *frame ) {
+    if ( capture->y4mFile ) {
+        capture_writeY4m( capture, frame );
+    }
+    uint64_t lastFrame = frame->frame + frame->repeat;
+    while ( capture->nextSnapshot < capture->snapshotCount &&
+            capture->snapshotFrames[capture->nextSnapshot] < lastFrame ) {
+        uint64_t snapshot = capture->snapshotFrames[capture->nextSnapshot++];
+        if ( capture->pngDirectory && snapshot >= frame->frame ) {
+            capture_writePng( capture, frame, snapshot );
+        }
+    }
+}
+
+static void *capture_writerThread( void *argument ) {
+    struct Capture *capture = argument;
+    struct CaptureFrame frame;
+    pthread_mutex_lock( &capture->lock );
+    while ( 1 ) {
+        while ( capture->head == capture->tail && !capture->closing ) {
+            pthread_cond_wait( &capture->ready, &capture->lock );
+        }
+        if ( capture->head == capture->tail ) {
+            break;
+        }
+        frame = capture->queue[capture->head % CAPTURE_QUEUE_SIZE];
+        capture->head++;
+        //only hold the lock while touching the queue, never while writing
+        pthread_mutex_unlock( &capture->lock );
+        capture_writeFrame( capture, &frame );
+        pthread_mutex_lock( &capture->lock );
+    }
+    pthread_mutex_unlock( &capture->lock );
+    return NULL;
+}
+
+static int capture_compareFrames( const void *a, const void *b ) {
+    uint64_t first = *( const uint64_t* ) a;
+    uint64_t second = *( const uint64_t* ) b;
+    return ( first > second ) - ( first < second );
+}
+
+struct Capture* capture_initialize( const char *y4mPath, const char *pngDirectory,
+                                    const uint64_t *snapshotFrames,
+                                    int snapshotCount, uint32_t framesPerSecond ) {
+    struct Capture *capture = malloc( sizeof( struct Capture ) );
+    if ( !capture ) {
+        fprintf( stderr, "Could not create new struct Capture\n" );
+        exit( 1 );
+    }
+    memset( capture, 0, sizeof( struct Capture ) );
+    capture_initializeCrcTable();
+
+    if ( y4mPath ) {
+        capture->y4mFile = fopen( y4mPath, "wb" );
+        if ( !capture->y4mFile ) {
+            fprintf( stderr, "Could not open %s for writing\n", y4mPath );
+            exit( 1 );
+        }
+        fprintf( capture->y4mFile, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C420jpeg\n",
+                 DISPLAY_WIDTH, DISPLAY_HEIGHT, framesPerSecond );
+    }
+    if ( pngDirectory ) {
+        capture->pngDirectory = strdup( pngDirectory );
+    }
+    if ( snapshotCount > 0 ) {
+        capture->snapshotFrames = malloc( sizeof( uint64_t ) * snapshotCount );
+        memcpy( capture->snapshotFrames, snapshotFrames,
+                sizeof( uint64_t ) * snapshotCount );
+        qsort( capture->snapshotFrames, snapshotCount, sizeof( uint64_t ),
+               capture_compareFrames );
+        capture->snapshotCount = snapshotCount;
+    }
+
+    pthread_mutex_init( &capture->lock, NULL );
+    pthread_cond_init( &capture->ready, NULL );
+    if ( pthread_create( &capture->writer, NULL, capture_writerThread, capture ) ) {
+        fprintf( stderr, "Could not start capture writer thread\n" );
+        exit( 1 );
+    }
+    return capture;
+}
+
+static void capture_queuePending( struct Capture *capture ) {
+    pthread_mutex_lock( &capture->lock );
+    if ( capture->tail - capture->head < CAPTURE_QUEUE_SIZE ) {
+        capture->queue[capture->tail % CAPTURE_QUEUE_SIZE] = capture->pending;
+        capture->tail++;
+        pthread_cond_signal( &capture->ready );
+    } else {
+        capture->droppedFrames++;
+    }
+    pthread_mutex_unlock( &capture->lock );
+}
+
+void capture_submitFrame( struct Capture *capture, struct Chip8 *chip ) {
+    uint8_t pixels[DISPLAY_HEIGHT][DISPLAY_ROW_BYTES];
+    ch8_packDisplay( chip, pixels );
+
+    if ( capture->frameCount > 0 &&
+         !memcmp( pixels, capture->pending.pixels, sizeof( pixels ) ) ) {
+        capture->pending.repeat++;
+    } else {
+        if ( capture->frameCount > 0 ) {
+            capture_queuePending( capture );
+        }
+        memcpy( capture->pending.pixels, pixels, sizeof( pixels ) );
+        capture->pending.frame = capture->frameCount;
+        capture->pending.repeat = 1;
+        capture->uniqueFrames++;
+    }
+    capture->frameCount++;
+}
+
+void capture_close( struct Capture *capture ) {
+    if ( capture->frameCount > 0 ) {
+        capture_queuePending( capture );
+    }
+    pthread_mutex_lock( &capture->lock );
+    capture->closing = true;
+    pthread_cond_signal( &capture->ready );
+    pthread_mutex_unlock( &capture->lock );
+    pthread_join( capture->writer, NULL );
+
+    fprintf( stderr, "Capture: %llu frames, %llu unique, %llu dropped\n",
+             ( unsigned long long ) capture->frameCount,
+             ( unsigned long long ) capture->uniqueFrames,
+             ( unsigned long long ) capture->droppedFrames );
+    if ( capture->y4mFile ) {
+        fclose( capture->y4mFile );
+    }
+    pthread_mutex_destroy( &capture->lock );
+    pthread_cond_destroy( &capture->ready );
+    free( capture->pngDirectory );
+    free( capture->snapshotFrames );
+    free( capture );
+}
@@ -0,0 +1,99 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "ch8.h"
+
+#define CAPTURE_QUEUE_SIZE 256 //frames that can wait on the writer thread
+
+/*
+ * One distinct display, packed 1 bit per pixel (row by row, most significant
+ * bit is the leftmost pixel), along with how many frames in a row showed it.
+ *
+ * @member pixels packed pixel data
+ * @member frame  number of the first frame that showed this display
+ * @member repeat how many frames in a row showed this display
+ */
+struct CaptureFrame {
+    uint8_t pixels[DISPLAY_HEIGHT][DISPLAY_ROW_BYTES];
+    uint64_t frame;
+    uint32_t repeat;
+};
+
+/*
+ * Records the display at every frame boundary and writes it out on a
+ * background thread, so the chip never waits on the disk.
+ *
+ * Frames identical to the previous one are never queued, only the repeat count
+ * of the pending frame goes up. If the writer falls so far behind that the
+ * queue is full, frames are dropped (and counted) rather than blocking.
+ *
+ * @member y4mFile        raw Y4M stream, NULL if not writing one
+ * @member pngDirectory   directory to write PNG snapshots to, NULL if none
+ * @member snapshotFrames sorted frame numbers to write PNG snapshots of
+ * @member snapshotCount  number of elements in snapshotFrames
+ * @member nextSnapshot   index of the next snapshot the writer is waiting on
+ * @member queue          frames waiting on the writer thread
+ * @member head           next queue slot the writer will read
+ * @member tail           next queue slot the chip will write
+ * @member pending        last distinct frame, not queued until it changes
+ * @member frameCount     frames submitted so far
+ * @member uniqueFrames   distinct frames seen so far
+ * @member droppedFrames  distinct frames lost because the queue was full
+ * @member closing        set when the writer should finish the queue and stop
+ * @member writer         background thread doing all of the file writes
+ * @member lock           protects head, tail and closing
+ * @member ready          signaled when a frame is queued or closing is set
+ */
+struct Capture {
+    FILE *y4mFile;
+    char *pngDirectory;
+    uint64_t *snapshotFrames;
+    int snapshotCount;
+    int nextSnapshot;
+    struct CaptureFrame queue[CAPTURE_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    struct CaptureFrame pending;
+    uint64_t frameCount;
+    uint64_t uniqueFrames;
+    uint64_t droppedFrames;
+    bool closing;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+};
+
+/*
+ * Open the outputs and start the writer thread
+ *
+ * A Y4M path may be a named pipe to feed an external encoder directly.
+ *
+ * @param y4mPath         file to write a Y4M stream to, NULL for none
+ * @param pngDirectory    directory to write PNG snapshots to, NULL for none
+ * @param snapshotFrames  frame numbers (starting at 0) to write PNGs of
+ * @param snapshotCount   number of elements in snapshotFrames
+ * @param framesPerSecond frame rate written in the Y4M header
+ * @return newly created Capture
+ */
+struct Capture* capture_initialize( const char *y4mPath, const char *pngDirectory,
+                                    const uint64_t *snapshotFrames,
+                                    int snapshotCount, uint32_t framesPerSecond );
+
+/*
+ * Record the display of a chip, should be called at every frame boundary
+ *
+ * @param capture Capture to record into
+ * @param chip    Chip8 to record the display of
+ */
+void capture_submitFrame( struct Capture *capture, struct Chip8 *chip );
+
+/*
+ * Flush the pending frame, wait for the writer to finish and free the Capture
+ *
+ * @param capture Capture to close
+ */
+void capture_close( struct Capture *capture );
+
+#endif
@@ -1,10 +1,28 @@
 #include "ch8.h"
-#include <time.h>
+#include "gdbstub.h"
+#include "runahead.h"
+#include "latency.h"
 #include <assert.h>
 
+static void ch8_fetchInstruction( struct Chip8 *chip );
+
+//wall clock seconds, clock() is processor time and stops while waiting
+static double ch8_seconds() {
+    return latency_now() / 1e9;
+}
 
 struct Chip8* ch8_initialize() {
+    struct Chip8 *chip = ch8_initializeHeadless();
+    chip->screen = screen_initialize(680, 480);
+    return chip;
+}
+
+struct Chip8* ch8_initializeHeadless() {
     struct Chip8 *chip = malloc( sizeof( struct Chip8 ) );
+    if ( !chip ) {
+        fprintf( stderr, "Could not create new struct Chip8\n" );
+        exit( 1 );
+    }
     memset( chip, 0, sizeof( struct Chip8 ) );
     chip->startingProgramAddress = 0x200;
     chip->programCounter = 0x200;
@@ -12,11 +30,24 @@ struct Chip8* ch8_initialize() {
     chip->secondsPerFrame = 1.0 / chip->framesPerSecond;
     chip->instructionsPerSecond = 700;
     chip->secondsPerInstruction = 1.0 / chip->instructionsPerSecond;
-    chip->screen = screen_initialize(680, 480);
+    ch8_seedRandom( chip, 1 );
     return chip;
 }
 
-void ch8_initializeFonts( struct Chip8 *chip, const uint16_t startingAddress ) {
+void ch8_seedRandom( struct Chip8 *chip, uint32_t seed ) {
+    chip->randomState = seed ? seed : 0x2545F491;
+}
+
+uint32_t ch8_random( struct Chip8 *chip ) {
+    uint32_t x = chip->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip->randomState = x;
+    return x;
+}
+
+void ch8_loadFonts( struct Chip8 *chip, const uint16_t startingAddress ) {
     static uint8_t fonts[16][5] = {
         { 0xF0, 0x90, 0x90, 0x90, 0xF0 }, //0
         { 0x20, 0x60, 0x20, 0x20, 0x70 }, //1
@@ -41,6 +72,10 @@ void ch8_initializeFonts( struct Chip8 *chip, const uint16_t startingAddress ) {
             chip->memory[startingAddress] = fonts[i][j];
         }
     }
+}
+
+void ch8_initializeFonts( struct Chip8 *chip, const uint16_t startingAddress ) {
+    ch8_loadFonts( chip, startingAddress );
     printf( "Fonts initialized\n" );
 }
 
@@ -78,7 +113,7 @@ void ch8_clearScreen( struct Chip8 *chip ) {
 
 void ch8_dumpMemory( struct Chip8 *chip ) {
     uint16_t lastProgramCounter = chip->programCounter;
-    float lastSecondsPerInstruction = chip->secondsPerInstruction;
+    double lastSecondsPerInstruction = chip->secondsPerInstruction;
     chip->secondsPerInstruction = 0;
     chip->programCounter = chip->startingProgramAddress;
     printf( "------Memory Dump------\n" );
@@ -273,6 +308,16 @@ void ch8_dumpMemory( struct Chip8 *chip ) {
     chip->secondsPerInstruction = lastSecondsPerInstruction;
 }
 
+void ch8_packDisplay( const struct Chip8 *chip,
+                      uint8_t pixels[DISPLAY_HEIGHT][DISPLAY_ROW_BYTES] ) {
+    memset( pixels, 0, DISPLAY_HEIGHT * DISPLAY_ROW_BYTES );
+    for ( int x = 0; x < DISPLAY_WIDTH; ++x ) {
+        for ( int y = 0; y < DISPLAY_HEIGHT; ++y ) {
+            pixels[y][x / 8] |= chip->display[x][y] << ( 7 - x % 8 );
+        }
+    }
+}
+
 void ch8_displaySprite( struct Chip8 *chip ) {
     uint8_t xPos = chip->registers[chip->optionX] % DISPLAY_WIDTH;
     uint8_t yPos = chip->registers[chip->optionY] % DISPLAY_HEIGHT;
@@ -292,48 +337,103 @@ void ch8_displaySprite( struct Chip8 *chip ) {
     }
 }
 
-void ch8_drawScreen( struct Chip8 *chip ) {
-    float currentTime = clock() * 1.0 / CLOCKS_PER_SEC;
+bool ch8_drawScreen( struct Chip8 *chip ) {
+    double currentTime = ch8_seconds();
     if ( currentTime - chip->lastDrawTime >= chip->secondsPerFrame ) {
         chip->lastDrawTime = currentTime;
+        if ( chip->runAhead ) {
+            ch8_updateScreen( runahead_speculate( chip->runAhead, chip ) );
+        } else {
+            ch8_updateScreen( chip );
+        }
         SDL_RenderPresent( chip->screen->renderer );
-        if ( chip->delayTimer > 0 ) { //TODO: move to their own function(s)
-            chip->delayTimer--;
+        ch8_tickTimers( chip );
+        if ( chip->latency ) {
+            latency_present( chip->latency );
+            latency_timerTick( chip->latency );
         }
-        if ( chip->soundTimer > 0 ) {
+        return true;
+    }
+    return false;
+}
+
+void ch8_tickTimers( struct Chip8 *chip ) {
+    if ( chip->delayTimer > 0 ) {
+        chip->delayTimer--;
+    }
+    if ( chip->soundTimer > 0 ) {
+        if ( chip->screen ) { //no one to hear it when headless
             fprintf( stdout, "\a" );
-            chip->soundTimer--;
         }
+        chip->soundTimer--;
+    }
+}
+
+bool ch8_runFrame( struct Chip8 *chip ) {
+    if ( chip->debugger && gdbstub_isWatching( chip->debugger ) ) {
+        return gdbstub_runFrame( chip->debugger, chip );
     }
+    uint32_t instructionsPerFrame = chip->instructionsPerSecond /
+                                    chip->framesPerSecond;
+    for ( uint32_t i = 0; i < instructionsPerFrame && !chip->keyBlocked; ++i ) {
+        ch8_step( chip );
+    }
+    ch8_tickTimers( chip );
+    return true;
 }
 
 void ch8_updateScreen( struct Chip8 *chip ) {
-    SDL_SetRenderDrawColor( chip->screen->renderer, 255, 0, 0, 255 );
-    for ( int i = 0; i < DISPLAY_WIDTH; ++i ) {
-        for ( int j = 0; j < DISPLAY_HEIGHT; ++j ) {
-            if ( chip->display[i][j] ) { 
-                SDL_Rect r = {chip->screen->xOffset + chip->screen->pixelSize * i,
-                              chip->screen->yOffset + chip->screen->pixelSize * j,
-                              chip->screen->pixelSize, 
-                              chip->screen->pixelSize};
-                //SDL_RenderFillRect( renderer, &r ); //filled rect
-                SDL_RenderDrawRect( chip->screen->renderer, &r );   //rect outline
-            }
+    struct Screen *screen = chip->screen;
+    scaler_render( screen->scaler, &chip->display[0][0] );
+    SDL_UpdateTexture( screen->texture, NULL, screen->scaler->pixels,
+                       screen->scaler->width * sizeof( uint32_t ) );
+    SDL_RenderCopy( screen->renderer, screen->texture, NULL, NULL );
+}
+
+void ch8_setKeys( struct Chip8 *chip, uint16_t keys ) {
+    uint16_t pressed = keys & ~chip->keys;
+    chip->keys = keys;
+    if ( chip->keyBlocked && pressed ) {
+        //the blocked FX0A is still the current instruction
+        uint8_t x = ( chip->currentInstruction & 0x0F00 ) >> 8;
+        chip->registers[x] = __builtin_ctz( pressed );
+        chip->keyBlocked = false;
+        chip->programCounter += 2;
+        if ( chip->latency ) {
+            latency_keyObserved( chip->latency );
         }
     }
 }
 
+bool ch8_instructionDue( struct Chip8 *chip ) {
+    double currentTime = ch8_seconds();
+    if ( currentTime - chip->lastInstructionTime >= chip->secondsPerInstruction ) {
+        chip->lastInstructionTime = currentTime;
+        return true;
+    }
+    return false;
+}
+
 void ch8_fetchNextInstruction( struct Chip8 *chip ) {
     if ( chip->keyBlocked ) {
         return;
     }
-    float currentTime = clock() * 1.0 / CLOCKS_PER_SEC;
-    if ( currentTime - chip->lastInstructionTime >= chip->secondsPerInstruction ) {
-        chip->lastInstructionTime = currentTime;
-        chip->instBlocked = false;
-    } else  {
+    if ( !ch8_instructionDue( chip ) ) {
         return;
     }
+    ch8_fetchInstruction( chip );
+}
+
+void ch8_step( struct Chip8 *chip ) {
+    if ( chip->keyBlocked ) {
+        return;
+    }
+    ch8_fetchInstruction( chip );
+    ch8_decodeAndExecuteCurrentInstruction( chip );
+}
+
+static void ch8_fetchInstruction( struct Chip8 *chip ) {
+    chip->instBlocked = false;
     chip->currentInstruction = chip->memory[chip->programCounter] << 8 |
                                chip->memory[chip->programCounter + 1];
 
@@ -356,6 +456,7 @@ void ch8_decodeAndExecuteCurrentInstruction( struct Chip8 *chip ) {
     }
 
     chip->instBlocked = true;
+    chip->frameInstructions++;
 
     switch ( chip->firstNibble ) {
         case 0x0:
@@ -363,6 +464,9 @@ void ch8_decodeAndExecuteCurrentInstruction( struct Chip8 *chip ) {
                 //clear screen
                 log( "Clearing screen\n" );
                 ch8_clearScreen( chip );
+                if ( chip->latency ) {
+                    latency_displayChanged( chip->latency );
+                }
             } else if ( chip->currentInstruction == 0x00EE ) {
                 assert( chip->stackAddress > 0 );
                 log( "Returning to last stack address: %x\n", chip->stack[chip->stackAddress - 1] );
@@ -373,6 +477,11 @@ void ch8_decodeAndExecuteCurrentInstruction( struct Chip8 *chip ) {
             //jump to address
             log( "Jumping from %x to %x\n", chip->programCounter - 2, 
                                             chip->optionNNN );
+            if ( chip->optionNNN <= chip->programCounter - 2 &&
+                 chip->programCounter - 2 - chip->optionNNN <= IDLE_LOOP_BYTES ) {
+                chip->frameIdleInstructions += ( chip->programCounter - 2 -
+                                                 chip->optionNNN ) / 2 + 1;
+            }
             chip->programCounter = chip->optionNNN;
             break;
         case 0x2:
@@ -472,28 +581,32 @@ void ch8_decodeAndExecuteCurrentInstruction( struct Chip8 *chip ) {
             break;
         case 0xC:
             //random number generator
-            chip->registers[chip->optionX] = rand() & chip->optionNN;
+            chip->registers[chip->optionX] = ch8_random( chip ) & chip->optionNN;
             break;
         case 0xD:
             log( "Displaying sprite with X: %x, Y: %x, N: %x\n", 
                     chip->registers[chip->optionX],
                     chip->registers[chip->optionY], chip->optionN );
             ch8_displaySprite( chip );
+            chip->frameDraws++;
+            if ( chip->latency ) {
+                latency_displayChanged( chip->latency );
+            }
             break;
         case 0xE:
+            if ( chip->latency ) {
+                latency_keyObserved( chip->latency );
+            }
             switch ( chip->optionY ) {
                 case 0x9:
                     //skip if key in VX is pressed
-                    if ( !chip->keyPressed ) {
-                        break; 
-                    }
-                    if ( chip->key == chip->registers[chip->optionX] ) {
+                    if ( ( chip->keys >> ( chip->registers[chip->optionX] & 0xF ) ) & 1 ) {
                         chip->programCounter += 2;
                     }
                     break;
                 case 0xA:
                     //skip if key in VX is not pressed
-                    if ( chip->keyPressed && chip->key != chip->registers[chip->optionX] ) {
+                    if ( !( ( chip->keys >> ( chip->registers[chip->optionX] & 0xF ) ) & 1 ) ) {
                         chip->programCounter += 2;
                     }
                     break;
@@ -503,6 +616,7 @@ void ch8_decodeAndExecuteCurrentInstruction( struct Chip8 *chip ) {
             switch ( chip->optionNN ) {
                 case 0x07:
                     chip->registers[chip->optionX] = chip->delayTimer;
+                    chip->frameTimerReads++;
                     break;
                 case 0x15:
                     chip->delayTimer = chip->registers[chip->optionX];
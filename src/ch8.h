@@ -6,6 +6,7 @@
 
 #define BYTES_MEMORY 4096 //standard is 4096
 #define STACK_SIZE 15 //standard is 16
+#define DISPLAY_ROW_BYTES ( DISPLAY_WIDTH / 8 ) //bytes per row of a packed display
 //#define DEBUG  //define to print debug messages
 #define STEP 0 //whether to wait for user input to step through instructions
 
@@ -15,6 +16,10 @@
 #define log(...) //if not debugging, don't printf
 #endif
 
+struct Debugger;
+struct RunAhead;
+struct Latency;
+
 struct Chip8 {
     bool keyBlocked; //if the chip should prevent instructions running because it 
                      //is waiting on a key
@@ -51,16 +56,33 @@ struct Chip8 {
     uint8_t optionN; //fourth 4 bits of current instruction
     uint8_t optionNN; //second 8 bits of current instruction (Y + N)
     uint16_t optionNNN; //final 12 bits of current instruction
-    float lastDrawTime; //time in seconds of last draw to screen
+    double lastDrawTime; //time in seconds of last draw to screen
     uint32_t framesPerSecond;
-    float secondsPerFrame;
-    float lastInstructionTime; //time in seconds of last instruction execution
+    double secondsPerFrame;
+    double lastInstructionTime; //time in seconds of last instruction execution
     uint32_t instructionsPerSecond;
-    float secondsPerInstruction;
-    bool keyPressed;
-    uint8_t key;
+    double secondsPerInstruction;
+    uint16_t keys; //bit per key of the hex keypad, set while it is held down
+    uint32_t randomState; //xorshift state for CXNN, kept in the chip so runs
+                          //can be repeated and compared
+    struct Debugger *debugger; //attached gdb stub, NULL if none
+    struct RunAhead *runAhead; //draws frames emulated ahead, NULL if off
+    struct Latency *latency; //input latency/jitter tracking, NULL if off
+    uint32_t frameInstructions; //instructions run since the counters below
+                                //were last reset (by the governor)
+    uint32_t frameDraws; //DXYN run
+    uint32_t frameTimerReads; //FX07 run
+    uint32_t frameIdleInstructions; //instructions spent in tight loops, a
+                                    //short backwards jump counts every
+                                    //instruction of the loop it closes
 };
 
+/*
+ * Largest distance (in bytes) a 1NNN can jump back and still be treated as
+ * the end of an idle loop, e.g. FX07 / 3X00 / 1NNN waiting on the delay timer
+ */
+#define IDLE_LOOP_BYTES 8
+
 /*
  * Set up the defaults for Chip8
  *
@@ -74,6 +96,32 @@ struct Chip8 {
  */
 struct Chip8* ch8_initialize();
 
+/*
+ * Set up the defaults for a Chip8 that has no window
+ *
+ * Same defaults as ch8_initialize, but no Screen (or SDL) is created, so the
+ * chip can only be driven with ch8_step/ch8_runFrame.
+ *
+ * @return pointer to the intialized Chip8
+ */
+struct Chip8* ch8_initializeHeadless();
+
+/*
+ * Seed the random number generator used by CXNN
+ *
+ * @param chip Chip8 to seed
+ * @param seed any value, 0 is replaced since xorshift can't leave it
+ */
+void ch8_seedRandom( struct Chip8 *chip, uint32_t seed );
+
+/*
+ * Next value of the chip's random number generator
+ *
+ * @param chip Chip8 to pull the value from
+ * @return the next random value
+ */
+uint32_t ch8_random( struct Chip8 *chip );
+
 /*
  * Load default fonts into Chip8 memory
  *
@@ -85,6 +133,14 @@ struct Chip8* ch8_initialize();
  */
 void ch8_initializeFonts( struct Chip8 *chip, const uint16_t startingAddress );
 
+/*
+ * Same as ch8_initializeFonts, without printing anything
+ *
+ * @param chip            Chip8 to add fonts to
+ * @param startingAddress address that the first font will start at
+ */
+void ch8_loadFonts( struct Chip8 *chip, const uint16_t startingAddress );
+
 /*
  * Read a binary file into the memory of a Chip8 to use as a program
  *
@@ -121,6 +177,19 @@ void ch8_clearProgramMemory( struct Chip8 *chip );
 void ch8_clearScreen( struct Chip8 *chip );
 
 void ch8_dumpMemory( struct Chip8 *chip );
+
+/*
+ * Pack the display 1 bit per pixel
+ *
+ * Rows go top to bottom, and the most significant bit of each byte is the
+ * leftmost pixel (the layout of a 1-bit PNG row).
+ *
+ * @param chip   Chip8 to pack the display of
+ * @param pixels packed display
+ */
+void ch8_packDisplay( const struct Chip8 *chip,
+                      uint8_t pixels[DISPLAY_HEIGHT][DISPLAY_ROW_BYTES] );
+
 /*
  * Display a sprite to the Screen
  *
@@ -141,25 +210,73 @@ void ch8_displaySprite( struct Chip8 *chip );
  * Update the SDL Window on the user's computer screen
  *
  * Uses the display data to set all of the pixels. This will also check to make
- * sure that the frame rate is being adhered to. Currently the delay/sound
+ * sure that the frame rate is being adhered to, the display is only scaled
+ * (ch8_updateScreen) when a frame is actually presented. With run-ahead on, the
+ * display shown is the one of the chip run ahead. Currently the delay/sound
  * timers are tied to this since they all are locked to 60 per second.
  * TODO: remove the tie to delay/sound timers
  *
  * @param chip Chip8 to draw the Screen of
+ * @return whether a frame was presented
+ */
+bool ch8_drawScreen( struct Chip8 *chip );
+
+/*
+ * Decrement the delay/sound timers, called once per frame
+ *
+ * @param chip Chip8 to update the timers of
+ */
+void ch8_tickTimers( struct Chip8 *chip );
+
+/*
+ * Run one frame worth of instructions as fast as possible
+ *
+ * Runs instructionsPerSecond / framesPerSecond instructions without waiting
+ * between them, then ticks the timers. Stops early if the chip blocks waiting
+ * on a key. Used to drive a chip that has no Screen.
+ *
+ * If a debugger has breakpoints or watchpoints set the frame goes through
+ * gdbstub_runFrame instead, and may be left unfinished.
+ *
+ * @param chip Chip8 to run
+ * @return whether the frame was finished
  */
-void ch8_drawScreen( struct Chip8 *chip );
+bool ch8_runFrame( struct Chip8 *chip );
 
 /*
  * Draw the pixels to the rendering buffer
  *
- * This will just draw the needed rectangles to the buffer in SDL, this will not
- * actually draw the Screen to the computer screen.
+ * The display is scaled into the Screen's texture by the software scaler, and
+ * the texture is copied to the renderer. This will not actually draw the
+ * Screen to the computer screen.
  * TODO: determine if this should be static
  *
  * @param chip Chip8 to update the Screen of
  */
 void ch8_updateScreen( struct Chip8 *chip );
 
+/*
+ * Whether enough time has passed to run another instruction
+ *
+ * Keeps the chip at instructionsPerSecond, when it returns true the time of
+ * the last instruction is moved up to now.
+ *
+ * @param chip Chip8 to check
+ * @return true if the next instruction should run
+ */
+bool ch8_instructionDue( struct Chip8 *chip );
+
+/*
+ * Update which keys of the hex keypad are held down
+ *
+ * If the chip is blocked on FX0A and a key was just pressed, the key goes in
+ * VX and the chip carries on.
+ *
+ * @param chip Chip8 to update the keys of
+ * @param keys bit per key, bit 0 is key 0 and so on
+ */
+void ch8_setKeys( struct Chip8 *chip, uint16_t keys );
+
 /*
  * Pull the next instruction from memory of the Chip8
  *
@@ -179,4 +296,14 @@ void ch8_fetchNextInstruction( struct Chip8 *chip );
  * @param chip Chip8 to decode/execute the instruction from
  */
 void ch8_decodeAndExecuteCurrentInstruction( struct Chip8 *chip );
+
+/*
+ * Fetch and execute the next instruction right away
+ *
+ * Unlike ch8_fetchNextInstruction this ignores instructionsPerSecond, pacing
+ * is left to the caller.
+ *
+ * @param chip Chip8 to step
+ */
+void ch8_step( struct Chip8 *chip );
 #endif
@@ -0,0 +1,270 @@
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "corpus.h"
+#include "latency.h"
+
+uint64_t checkpoint_programHash( const struct Chip8 *chip ) {
+    return corpus_hash( 0, chip->memory, sizeof( chip->memory ) );
+}
+
+/*
+ * Write the staging buffer to the temporary file through a mapping of it, and
+ * move it over the checkpoint
+ *
+ * @return whether the checkpoint made it to disk
+ */
+static bool checkpoint_write( struct Checkpoint *checkpoint ) {
+    int fd = open( checkpoint->temporary, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 ) {
+        return false;
+    }
+    if ( ftruncate( fd, checkpoint->stagingSize ) ) {
+        close( fd );
+        return false;
+    }
+    void *map = mmap( NULL, checkpoint->stagingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0 );
+    if ( map == MAP_FAILED ) {
+        close( fd );
+        return false;
+    }
+    memcpy( map, checkpoint->staging, checkpoint->stagingSize );
+    bool synced = !msync( map, checkpoint->stagingSize, MS_SYNC );
+    munmap( map, checkpoint->stagingSize );
+    close( fd );
+    if ( !synced || rename( checkpoint->temporary, checkpoint->path ) ) {
+        return false;
+    }
+    //the rename itself only survives a crash once the directory is synced
+    int directory = open( checkpoint->directory, O_RDONLY );
+    if ( directory >= 0 ) {
+        fsync( directory );
+        close( directory );
+    }
+    return true;
+}
+
+static void *checkpoint_writerThread( void *argument ) {
+    struct Checkpoint *checkpoint = argument;
+    pthread_mutex_lock( &checkpoint->lock );
+    while ( 1 ) {
+        while ( !checkpoint->writing && !checkpoint->closing ) {
+            pthread_cond_wait( &checkpoint->ready, &checkpoint->lock );
+        }
+        if ( !checkpoint->writing ) {
+            break;
+        }
+        //staging is left alone by checkpoint_submit while writing is set
+        pthread_mutex_unlock( &checkpoint->lock );
+        uint64_t start = latency_now();
+        bool written = checkpoint_write( checkpoint );
+        double seconds = ( latency_now() - start ) / 1e9;
+        if ( !written ) {
+            fprintf( stderr, "Could not write checkpoint %s\n", checkpoint->path );
+        }
+        pthread_mutex_lock( &checkpoint->lock );
+        checkpoint->writeSeconds += seconds;
+        checkpoint->written += written;
+        checkpoint->failed += !written;
+        checkpoint->writing = false;
+        pthread_cond_broadcast( &checkpoint->done );
+    }
+    pthread_mutex_unlock( &checkpoint->lock );
+    return NULL;
+}
+
+struct Checkpoint* checkpoint_initialize( const char *path, uint64_t programHash ) {
+    struct Checkpoint *checkpoint = malloc( sizeof( struct Checkpoint ) );
+    if ( !checkpoint ) {
+        fprintf( stderr, "Could not create new struct Checkpoint\n" );
+        exit( 1 );
+    }
+    memset( checkpoint, 0, sizeof( struct Checkpoint ) );
+    checkpoint->path = strdup( path );
+    checkpoint->temporary = malloc( strlen( path ) + 5 );
+    sprintf( checkpoint->temporary, "%s.tmp", path );
+    char *copy = strdup( path );
+    checkpoint->directory = strdup( dirname( copy ) );
+    free( copy );
+    checkpoint->programHash = programHash;
+
+    pthread_mutex_init( &checkpoint->lock, NULL );
+    pthread_cond_init( &checkpoint->ready, NULL );
+    pthread_cond_init( &checkpoint->done, NULL );
+    if ( pthread_create( &checkpoint->writer, NULL, checkpoint_writerThread, checkpoint ) ) {
+        fprintf( stderr, "Could not start checkpoint writer thread\n" );
+        exit( 1 );
+    }
+    return checkpoint;
+}
+
+void checkpoint_submit( struct Checkpoint *checkpoint, struct Chip8 *const *chips,
+                        uint32_t instances, const struct Governor *governor,
+                        uint64_t frame ) {
+    uint64_t start = latency_now();
+    pthread_mutex_lock( &checkpoint->lock );
+    bool busy = checkpoint->writing;
+    checkpoint->skipped += busy;
+    pthread_mutex_unlock( &checkpoint->lock );
+    if ( busy ) {
+        return;
+    }
+
+    size_t size = sizeof( struct CheckpointHeader ) + instances * sizeof( struct Chip8 );
+    if ( size > checkpoint->capacity ) {
+        checkpoint->staging = realloc( checkpoint->staging, size );
+        if ( !checkpoint->staging ) {
+            fprintf( stderr, "Could not grow checkpoint staging buffer\n" );
+            exit( 1 );
+        }
+        checkpoint->capacity = size;
+    }
+    struct CheckpointHeader header = { 0 };
+    memcpy( header.magic, CHECKPOINT_MAGIC, sizeof( header.magic ) );
+    header.version = CHECKPOINT_VERSION;
+    header.chipSize = sizeof( struct Chip8 );
+    header.instances = instances;
+    header.frame = frame;
+    header.programHash = checkpoint->programHash;
+    if ( governor ) {
+        header.governed = 1;
+        header.governor.frames = governor->frames;
+        header.governor.blockedFrames = governor->blockedFrames;
+        header.governor.instructions = governor->instructions;
+        header.governor.draws = governor->draws;
+        header.governor.timerReads = governor->timerReads;
+        header.governor.idle = governor->idle;
+        header.governor.changes = governor->changes;
+    }
+    memcpy( checkpoint->staging, &header, sizeof( header ) );
+    uint8_t *record = checkpoint->staging + sizeof( header );
+    for ( uint32_t i = 0; i < instances; ++i ) {
+        memcpy( record, chips[i], sizeof( struct Chip8 ) );
+        record += sizeof( struct Chip8 );
+    }
+
+    pthread_mutex_lock( &checkpoint->lock );
+    checkpoint->stagingSize = size;
+    checkpoint->writing = true;
+    pthread_cond_signal( &checkpoint->ready );
+    pthread_mutex_unlock( &checkpoint->lock );
+
+    double seconds = ( latency_now() - start ) / 1e9;
+    if ( seconds > checkpoint->copySeconds ) {
+        checkpoint->copySeconds = seconds;
+    }
+}
+
+void checkpoint_flush( struct Checkpoint *checkpoint ) {
+    pthread_mutex_lock( &checkpoint->lock );
+    while ( checkpoint->writing ) {
+        pthread_cond_wait( &checkpoint->done, &checkpoint->lock );
+    }
+    pthread_mutex_unlock( &checkpoint->lock );
+}
+
+bool checkpoint_restore( const char *path, struct Chip8 *const *chips,
+                         uint32_t instances, struct Governor *governor,
+                         uint64_t programHash, uint64_t *frame ) {
+    int fd = open( path, O_RDONLY );
+    struct stat status;
+    if ( fd < 0 || fstat( fd, &status ) ) {
+        fprintf( stderr, "Could not open checkpoint %s\n", path );
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        return false;
+    }
+    size_t size = sizeof( struct CheckpointHeader ) + instances * sizeof( struct Chip8 );
+    if ( ( size_t ) status.st_size != size ) {
+        fprintf( stderr, "Checkpoint %s is not for %u chips of this build\n", path,
+                 instances );
+        close( fd );
+        return false;
+    }
+    const uint8_t *map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED ) {
+        fprintf( stderr, "Could not map checkpoint %s\n", path );
+        return false;
+    }
+
+    struct CheckpointHeader header;
+    memcpy( &header, map, sizeof( header ) );
+    bool valid = !memcmp( header.magic, CHECKPOINT_MAGIC, sizeof( header.magic ) ) &&
+                 header.version == CHECKPOINT_VERSION &&
+                 header.chipSize == sizeof( struct Chip8 ) &&
+                 header.instances == instances;
+    if ( !valid ) {
+        fprintf( stderr, "Checkpoint %s is not for %u chips of this build\n", path,
+                 instances );
+    } else if ( header.programHash != programHash ) {
+        fprintf( stderr, "Checkpoint %s was taken running a different ROM\n", path );
+        valid = false;
+    }
+
+    const uint8_t *record = map + sizeof( header );
+    for ( uint32_t i = 0; valid && i < instances; ++i ) {
+        struct Chip8 *chip = chips[i];
+        struct Screen *screen = chip->screen;
+        struct Debugger *debugger = chip->debugger;
+        struct RunAhead *runAhead = chip->runAhead;
+        struct Latency *latency = chip->latency;
+        memcpy( chip, record, sizeof( struct Chip8 ) );
+        chip->screen = screen;
+        chip->debugger = debugger;
+        chip->runAhead = runAhead;
+        chip->latency = latency;
+        //times are from the clock of the process that took the checkpoint
+        chip->lastDrawTime = 0;
+        chip->lastInstructionTime = 0;
+        record += sizeof( struct Chip8 );
+    }
+    munmap( ( void* ) map, size );
+    if ( valid ) {
+        *frame = header.frame;
+    }
+    //without one a governed resume just starts a new window
+    if ( valid && governor && header.governed ) {
+        governor->frames = header.governor.frames;
+        governor->blockedFrames = header.governor.blockedFrames;
+        governor->instructions = header.governor.instructions;
+        governor->draws = header.governor.draws;
+        governor->timerReads = header.governor.timerReads;
+        governor->idle = header.governor.idle;
+        governor->changes = header.governor.changes;
+    }
+    return valid;
+}
+
+void checkpoint_close( struct Checkpoint *checkpoint ) {
+    pthread_mutex_lock( &checkpoint->lock );
+    checkpoint->closing = true;
+    pthread_cond_signal( &checkpoint->ready );
+    pthread_mutex_unlock( &checkpoint->lock );
+    pthread_join( checkpoint->writer, NULL );
+
+    fprintf( stderr, "Checkpoint: %llu written, %llu skipped (writer busy), "
+                     "%llu failed, %.3f ms longest copy, %.3f ms per write\n",
+             ( unsigned long long ) checkpoint->written,
+             ( unsigned long long ) checkpoint->skipped,
+             ( unsigned long long ) checkpoint->failed,
+             checkpoint->copySeconds * 1e3,
+             checkpoint->written ?
+             checkpoint->writeSeconds * 1e3 / checkpoint->written : 0.0 );
+    pthread_mutex_destroy( &checkpoint->lock );
+    pthread_cond_destroy( &checkpoint->ready );
+    pthread_cond_destroy( &checkpoint->done );
+    free( checkpoint->path );
+    free( checkpoint->temporary );
+    free( checkpoint->directory );
+    free( checkpoint->staging );
+    free( checkpoint );
+}
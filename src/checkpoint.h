@@ -0,0 +1,181 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ch8.h"
+#include "governor.h"
+
+#define CHECKPOINT_MAGIC "CH8CKPT"
+#define CHECKPOINT_VERSION 2 //bump when the file layout changes
+
+/*
+ * Window of a Governor, so a governed run resumes with the same decisions
+ *
+ * @member frames        Governor frames
+ * @member blockedFrames Governor blockedFrames
+ * @member instructions  Governor instructions
+ * @member draws         Governor draws
+ * @member timerReads    Governor timerReads
+ * @member idle          Governor idle
+ * @member changes       Governor changes
+ * @member padding       keeps the size the same everywhere
+ */
+struct CheckpointGovernor {
+    uint32_t frames;
+    uint32_t blockedFrames;
+    uint64_t instructions;
+    uint64_t draws;
+    uint64_t timerReads;
+    uint64_t idle;
+    uint32_t changes;
+    uint32_t padding;
+};
+
+/*
+ * Start of a checkpoint file, followed by instances copies of struct Chip8
+ *
+ * The chips are stored as they are in memory, so a checkpoint can only be
+ * resumed by a build with the same struct Chip8 (chipSize catches most
+ * mismatches). Pointers are stored too, but never restored.
+ *
+ * @member magic      CHECKPOINT_MAGIC
+ * @member version    CHECKPOINT_VERSION
+ * @member chipSize   sizeof( struct Chip8 )
+ * @member instances  chips in the file
+ * @member frame      frames run, where a resumed run picks up from
+ * @member programHash hash of the memory the chips started with (ROM and
+ *                    fonts), to catch resuming with the wrong ROM
+ * @member governed   whether governor is from a Governor, rather than zeroed
+ * @member governor   window of the Governor of the run, if governed
+ */
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chipSize;
+    uint32_t instances;
+    uint32_t governed;
+    uint64_t frame;
+    uint64_t programHash;
+    struct CheckpointGovernor governor;
+};
+
+/*
+ * Writes checkpoints of running chips without holding them up
+ *
+ * checkpoint_submit only copies the chips into a staging buffer, a writer
+ * thread does the rest: it maps a temporary file, copies the staging buffer
+ * into it, syncs it and renames it over the checkpoint, so the checkpoint on
+ * disk is always a whole one. A checkpoint submitted while the last one is
+ * still being written is skipped rather than waited on.
+ *
+ * @member path        checkpoint file
+ * @member temporary   file the next checkpoint is written to, then renamed
+ * @member directory   directory of path, synced after every rename
+ * @member staging     header and chips of the checkpoint to write next
+ * @member stagingSize bytes in staging
+ * @member capacity    bytes staging has room for
+ * @member programHash put in the header of every checkpoint
+ * @member writing     whether the writer has a checkpoint it hasn't finished
+ * @member closing     whether the writer should exit once it is done
+ * @member lock        guards staging, writing and closing
+ * @member ready       signalled when a checkpoint is submitted
+ * @member done        signalled when a checkpoint is finished
+ * @member writer      writer thread
+ * @member written     checkpoints written
+ * @member skipped     checkpoints skipped because the writer was busy
+ * @member failed      checkpoints that could not be written
+ * @member copySeconds longest time checkpoint_submit took
+ * @member writeSeconds time the writer spent writing
+ */
+struct Checkpoint {
+    char *path;
+    char *temporary;
+    char *directory;
+    uint8_t *staging;
+    size_t stagingSize;
+    size_t capacity;
+    uint64_t programHash;
+    bool writing;
+    bool closing;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t done;
+    pthread_t writer;
+    uint64_t written;
+    uint64_t skipped;
+    uint64_t failed;
+    double copySeconds;
+    double writeSeconds;
+};
+
+/*
+ * Hash of the memory a chip starts with, taken after the ROM is loaded
+ *
+ * @param chip Chip8 that hasn't run yet
+ * @return the hash
+ */
+uint64_t checkpoint_programHash( const struct Chip8 *chip );
+
+/*
+ * Create a Checkpoint and start its writer
+ *
+ * @param path        file to keep the latest checkpoint in
+ * @param programHash checkpoint_programHash of the chips being checkpointed
+ * @return newly created Checkpoint
+ */
+struct Checkpoint* checkpoint_initialize( const char *path, uint64_t programHash );
+
+/*
+ * Queue a checkpoint of some chips
+ *
+ * Returns right after copying the chips, the file is written in the
+ * background. Does nothing (but count it) if the previous checkpoint is still
+ * being written.
+ *
+ * @param checkpoint Checkpoint to write with
+ * @param chips      chips to save
+ * @param instances  number of elements in chips
+ * @param governor   Governor of the run to save the window of, NULL for none
+ * @param frame      frames run so far
+ */
+void checkpoint_submit( struct Checkpoint *checkpoint, struct Chip8 *const *chips,
+                        uint32_t instances, const struct Governor *governor,
+                        uint64_t frame );
+
+/*
+ * Wait for the checkpoint being written (if any) to be finished
+ *
+ * @param checkpoint Checkpoint to wait on
+ */
+void checkpoint_flush( struct Checkpoint *checkpoint );
+
+/*
+ * Restore chips from a checkpoint file
+ *
+ * Everything in the chips is replaced but their pointers (Screen, debugger,
+ * run-ahead and latency tracking), which are left as they are. The window of
+ * the governor is restored too if the checkpoint has one, its settings are
+ * left as they are.
+ *
+ * @param path        checkpoint file
+ * @param chips       chips to restore, with the ROM already loaded
+ * @param instances   number of elements in chips
+ * @param governor    Governor to restore the window of, NULL for none
+ * @param programHash checkpoint_programHash of the chips before restoring
+ * @param frame       set to the frame the checkpoint was taken at
+ * @return whether the chips were restored
+ */
+bool checkpoint_restore( const char *path, struct Chip8 *const *chips,
+                         uint32_t instances, struct Governor *governor,
+                         uint64_t programHash, uint64_t *frame );
+
+/*
+ * Wait for the checkpoint being written, print the stats and free a
+ * Checkpoint
+ *
+ * @param checkpoint Checkpoint to close
+ */
+void checkpoint_close( struct Checkpoint *checkpoint );
+
+#endif
@@ -0,0 +1,495 @@
+#include "corpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lockstep.h"
+#include "latency.h"
+
+#ifndef CH8_CORE_VERSION
+#define CH8_CORE_VERSION "unknown" //the Makefile sets it from the core sources
+#endif
+
+#define CORPUS_MAX_ROM_BYTES ( BYTES_MEMORY - 0x200 )
+#define CORPUS_PATH_SIZE 4096
+#define CORPUS_MAX_DIRECTORY ( CORPUS_PATH_SIZE - 32 ) //room for the file names
+
+uint64_t corpus_hash( uint64_t hash, const void *data, size_t length ) {
+    const uint8_t *bytes = data;
+    if ( !hash ) {
+        hash = 0xCBF29CE484222325ull;
+    }
+    for ( size_t i = 0; i < length; ++i ) {
+        hash = ( hash ^ bytes[i] ) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t corpus_hashState( const struct Chip8 *chip ) {
+    //field by field, so padding never ends up in the hash
+    uint64_t hash = corpus_hash( 0, chip->registers, sizeof( chip->registers ) );
+    hash = corpus_hash( hash, &chip->indexRegister, sizeof( chip->indexRegister ) );
+    hash = corpus_hash( hash, &chip->programCounter, sizeof( chip->programCounter ) );
+    hash = corpus_hash( hash, chip->stack, sizeof( chip->stack ) );
+    hash = corpus_hash( hash, &chip->stackAddress, sizeof( chip->stackAddress ) );
+    hash = corpus_hash( hash, &chip->delayTimer, sizeof( chip->delayTimer ) );
+    hash = corpus_hash( hash, &chip->soundTimer, sizeof( chip->soundTimer ) );
+    hash = corpus_hash( hash, &chip->randomState, sizeof( chip->randomState ) );
+    hash = corpus_hash( hash, &chip->keyBlocked, sizeof( chip->keyBlocked ) );
+    hash = corpus_hash( hash, chip->memory, sizeof( chip->memory ) );
+    return corpus_hash( hash, chip->display, sizeof( chip->display ) );
+}
+
+int corpus_opcodeClass( uint16_t opcode ) {
+    uint8_t n = opcode & 0x000F;
+    uint8_t nn = opcode & 0x00FF;
+    switch ( opcode >> 12 ) {
+        case 0x0: return opcode == 0x00E0 ? 0 : opcode == 0x00EE ? 1 : 2;
+        case 0x1: return 3;
+        case 0x2: return 4;
+        case 0x3: return 5;
+        case 0x4: return 6;
+        case 0x5: return n == 0 ? 7 : -1;
+        case 0x6: return 8;
+        case 0x7: return 9;
+        case 0x8: return n <= 7 ? 10 + n : n == 0xE ? 18 : -1;
+        case 0x9: return n == 0 ? 19 : -1;
+        case 0xA: return 20;
+        case 0xB: return 21;
+        case 0xC: return 22;
+        case 0xD: return 23;
+        case 0xE: return nn == 0x9E ? 24 : nn == 0xA1 ? 25 : -1;
+        case 0xF:
+            switch ( nn ) {
+                case 0x07: return 26;
+                case 0x0A: return 27;
+                case 0x15: return 28;
+                case 0x18: return 29;
+                case 0x1E: return 30;
+                case 0x29: return 31;
+                case 0x33: return 32;
+                case 0x55: return 33;
+                case 0x65: return 34;
+            }
+    }
+    return -1;
+}
+
+static uint32_t corpus_quirksOf( int opcodeClass ) {
+    switch ( opcodeClass ) {
+        case 11: case 12: case 13: return QUIRK_VF_RESET;
+        case 16: case 18: return QUIRK_SHIFT;
+        case 21: return QUIRK_JUMP;
+        case 30: return QUIRK_INDEX_OVERFLOW;
+        case 33: case 34: return QUIRK_LOAD_STORE;
+    }
+    return 0;
+}
+
+static void corpus_formatQuirks( uint32_t quirks, char *out, size_t size ) {
+    static const char *names[] = { "vfReset", "shift", "loadStore", "jump",
+                                   "indexOverflow" };
+    out[0] = '\0';
+    for ( int i = 0; i < 5; ++i ) {
+        if ( quirks & 1 << i ) {
+            if ( out[0] ) {
+                strncat( out, ",", size - strlen( out ) - 1 );
+            }
+            strncat( out, names[i], size - strlen( out ) - 1 );
+        }
+    }
+    if ( !out[0] ) {
+        strncat( out, "none", size - 1 );
+    }
+}
+
+//scratch space of corpus_analyze, one flag per address
+static bool visited[BYTES_MEMORY]; //decoded as an instruction
+static bool queued[BYTES_MEMORY]; //put on the worklist
+static bool leader[BYTES_MEMORY]; //jumped, called or skipped to
+static bool ends[BYTES_MEMORY]; //jump, return, skip or data
+static bool covered[BYTES_MEMORY]; //put in a block
+static uint16_t work[BYTES_MEMORY];
+static int pending;
+
+static void corpus_queue( uint16_t address ) {
+    leader[address] = true;
+    if ( !queued[address] ) {
+        queued[address] = true;
+        work[pending++] = address;
+    }
+}
+
+/*
+ * Find the code reachable from the program start, a worklist of addresses
+ * each followed in a straight line until a jump, return or data
+ */
+static void corpus_analyze( struct CorpusAnalysis *analysis, const uint8_t *rom,
+                            size_t romLength ) {
+    uint8_t memory[BYTES_MEMORY] = { 0 };
+    memcpy( memory + 0x200, rom, romLength );
+    memset( visited, 0, sizeof( visited ) );
+    memset( queued, 0, sizeof( queued ) );
+    memset( leader, 0, sizeof( leader ) );
+    memset( ends, 0, sizeof( ends ) );
+    memset( covered, 0, sizeof( covered ) );
+    pending = 0;
+
+    corpus_queue( 0x200 );
+    while ( pending ) {
+        uint16_t address = work[--pending];
+        while ( address <= BYTES_MEMORY - 2 && !visited[address] ) {
+            visited[address] = true;
+            uint16_t opcode = memory[address] << 8 | memory[address + 1];
+            int opcodeClass = corpus_opcodeClass( opcode );
+            uint16_t next = address + 2;
+            analysis->instructions++;
+            if ( opcodeClass >= 0 ) {
+                analysis->opcodes |= 1ull << opcodeClass;
+                analysis->quirks |= corpus_quirksOf( opcodeClass );
+            }
+            switch ( opcodeClass ) {
+                case -1: //data, or code that isn't CHIP-8
+                case 1: //00EE
+                case 2: //0NNN, machine code that can't be followed
+                    ends[address] = true;
+                    break;
+                case 3: //1NNN
+                    ends[address] = true;
+                    corpus_queue( opcode & 0x0FFF );
+                    break;
+                case 4: //2NNN, the return lands on the next instruction
+                    ends[address] = true;
+                    corpus_queue( opcode & 0x0FFF );
+                    if ( next <= BYTES_MEMORY - 2 ) {
+                        corpus_queue( next );
+                    }
+                    break;
+                case 21: //BNNN
+                    ends[address] = true;
+                    analysis->indirect = true;
+                    break;
+                case 5: case 6: case 7: case 19: case 24: case 25: //skips
+                    ends[address] = true;
+                    if ( next <= BYTES_MEMORY - 2 ) {
+                        corpus_queue( next );
+                    }
+                    if ( next + 2 <= BYTES_MEMORY - 2 ) {
+                        corpus_queue( next + 2 );
+                    }
+                    break;
+            }
+            if ( ends[address] ) {
+                break;
+            }
+            address = next;
+        }
+    }
+
+    for ( int address = 0; address < BYTES_MEMORY; ++address ) {
+        if ( !visited[address] || covered[address] ) {
+            continue;
+        }
+        struct CorpusBlock block = { address, 0 };
+        int end = address;
+        bool stop;
+        do {
+            covered[end] = true;
+            block.length += 2;
+            stop = ends[end];
+            end += 2;
+        } while ( !stop && end < BYTES_MEMORY && visited[end] && !leader[end] );
+        if ( analysis->blockCount < CORPUS_MAX_BLOCKS ) {
+            analysis->blocks[analysis->blockCount++] = block;
+        } else {
+            analysis->truncated = true;
+        }
+    }
+}
+
+static void corpus_execute( struct CorpusRun *run, const uint8_t *rom, size_t romLength ) {
+    struct Chip8 *chip = ch8_initializeHeadless();
+    ch8_loadFonts( chip, 0x50 ); //quietly, stdout has the report
+    memcpy( chip->memory + chip->startingProgramAddress, rom, romLength );
+    ch8_seedRandom( chip, run->seed );
+    if ( run->speed ) {
+        chip->instructionsPerSecond = run->speed;
+        chip->secondsPerInstruction = 1.0 / run->speed;
+    }
+
+    uint32_t instructionsPerFrame = chip->instructionsPerSecond / chip->framesPerSecond;
+    for ( uint64_t frame = 0; frame < run->frames && !run->blocked && !run->faulted;
+          ++frame ) {
+        for ( uint32_t i = 0; i < instructionsPerFrame; ++i ) {
+            if ( chip->keyBlocked ) {
+                run->blocked = true; //no one is there to press a key
+                break;
+            }
+            if ( !lockstep_isSafe( chip ) ) {
+                run->faulted = true;
+                break;
+            }
+            ch8_step( chip );
+            run->instructions++;
+            int opcodeClass = corpus_opcodeClass( chip->currentInstruction );
+            if ( opcodeClass >= 0 ) {
+                run->coverage |= 1ull << opcodeClass;
+            }
+        }
+        ch8_tickTimers( chip );
+    }
+    run->stateHash = corpus_hashState( chip );
+    free( chip );
+}
+
+/*
+ * Write a cache file under a temporary name and move it into place, so a
+ * reader never sees half of one, even with several runs sharing the cache
+ */
+static FILE* corpus_openTemporary( const char *path, char *temporary, size_t size ) {
+    if ( snprintf( temporary, size, "%s.%d.tmp", path, ( int ) getpid() ) >= ( int ) size ) {
+        fprintf( stderr, "Path too long: %s\n", path );
+        return NULL;
+    }
+    FILE *file = fopen( temporary, "w" );
+    if ( !file ) {
+        fprintf( stderr, "Could not open %s for writing\n", temporary );
+    }
+    return file;
+}
+
+static void corpus_commitTemporary( FILE *file, const char *temporary, const char *path ) {
+    if ( fclose( file ) || rename( temporary, path ) ) {
+        fprintf( stderr, "Could not write %s\n", path );
+        unlink( temporary );
+    }
+}
+
+static bool corpus_loadAnalysis( struct CorpusAnalysis *analysis, const char *path,
+                                 uint64_t romHash ) {
+    FILE *file = fopen( path, "r" );
+    if ( !file ) {
+        return false;
+    }
+    unsigned int version = 0;
+    unsigned long long hash = 0;
+    unsigned long long opcodes = 0;
+    unsigned int indirect = 0;
+    unsigned int truncated = 0;
+    bool ok = fscanf( file, "version %u\nrom %llx\ninstructions %u\nquirks %x\n"
+                            "opcodes %llx\nindirect %u\ntruncated %u\nblocks %u\n",
+                      &version, &hash, &analysis->instructions, &analysis->quirks,
+                      &opcodes, &indirect, &truncated, &analysis->blockCount ) == 8 &&
+              version == CORPUS_ANALYSIS_VERSION && hash == romHash &&
+              analysis->blockCount <= CORPUS_MAX_BLOCKS;
+    for ( uint32_t i = 0; ok && i < analysis->blockCount; ++i ) {
+        unsigned int start;
+        unsigned int length;
+        ok = fscanf( file, "%x %u\n", &start, &length ) == 2;
+        analysis->blocks[i].start = start;
+        analysis->blocks[i].length = length;
+    }
+    fclose( file );
+    analysis->romHash = romHash;
+    analysis->opcodes = opcodes;
+    analysis->indirect = indirect;
+    analysis->truncated = truncated;
+    return ok;
+}
+
+static void corpus_storeAnalysis( const struct CorpusAnalysis *analysis, const char *path ) {
+    char temporary[CORPUS_PATH_SIZE + 16];
+    FILE *file = corpus_openTemporary( path, temporary, sizeof( temporary ) );
+    if ( !file ) {
+        return;
+    }
+    fprintf( file, "version %u\nrom %016llx\ninstructions %u\nquirks %x\n"
+                   "opcodes %llx\nindirect %u\ntruncated %u\nblocks %u\n",
+             CORPUS_ANALYSIS_VERSION, ( unsigned long long ) analysis->romHash,
+             analysis->instructions, analysis->quirks,
+             ( unsigned long long ) analysis->opcodes, analysis->indirect,
+             analysis->truncated, analysis->blockCount );
+    for ( uint32_t i = 0; i < analysis->blockCount; ++i ) {
+        fprintf( file, "%03x %u\n", analysis->blocks[i].start, analysis->blocks[i].length );
+    }
+    corpus_commitTemporary( file, temporary, path );
+}
+
+static bool corpus_loadRun( struct CorpusRun *run, const char *path ) {
+    FILE *file = fopen( path, "r" );
+    if ( !file ) {
+        return false;
+    }
+    unsigned long long key = 0;
+    char core[128] = "";
+    unsigned long long instructions = 0;
+    unsigned long long coverage = 0;
+    unsigned long long stateHash = 0;
+    unsigned int blocked = 0;
+    unsigned int faulted = 0;
+    bool ok = fscanf( file, "key %llx\ncore %127s\ninstructions %llu\ncoverage %llx\n"
+                            "state %llx\nblocked %u\nfaulted %u\n",
+                      &key, core, &instructions, &coverage, &stateHash, &blocked,
+                      &faulted ) == 7 &&
+              key == run->key && !strcmp( core, CH8_CORE_VERSION );
+    fclose( file );
+    run->instructions = instructions;
+    run->coverage = coverage;
+    run->stateHash = stateHash;
+    run->blocked = blocked;
+    run->faulted = faulted;
+    return ok;
+}
+
+static void corpus_storeRun( const struct CorpusRun *run, const char *path ) {
+    char temporary[CORPUS_PATH_SIZE + 16];
+    FILE *file = corpus_openTemporary( path, temporary, sizeof( temporary ) );
+    if ( !file ) {
+        return;
+    }
+    fprintf( file, "key %016llx\ncore %s\ninstructions %llu\ncoverage %llx\n"
+                   "state %016llx\nblocked %u\nfaulted %u\n",
+             ( unsigned long long ) run->key, CH8_CORE_VERSION,
+             ( unsigned long long ) run->instructions,
+             ( unsigned long long ) run->coverage,
+             ( unsigned long long ) run->stateHash, run->blocked, run->faulted );
+    corpus_commitTemporary( file, temporary, path );
+}
+
+/*
+ * Read a whole ROM
+ *
+ * @return bytes read, 0 if the file can't be read or doesn't fit in memory
+ */
+static size_t corpus_readRom( const char *path, uint8_t rom[CORPUS_MAX_ROM_BYTES] ) {
+    FILE *file = fopen( path, "rb" );
+    if ( !file ) {
+        fprintf( stderr, "Cannot find file at path %s\n", path );
+        return 0;
+    }
+    size_t length = fread( rom, 1, CORPUS_MAX_ROM_BYTES, file );
+    if ( fgetc( file ) != EOF ) {
+        fprintf( stderr, "%s does not fit in memory\n", path );
+        length = 0;
+    }
+    fclose( file );
+    return length;
+}
+
+static int corpus_compareNames( const void *a, const void *b ) {
+    return strcmp( *( char* const* ) a, *( char* const* ) b );
+}
+
+/*
+ * Every .ch8 file in a directory, sorted so the report is in a stable order
+ *
+ * @return number of paths put in paths, each one to be freed
+ */
+static int corpus_listRoms( const char *directory, char *paths[CORPUS_MAX_ROMS] ) {
+    DIR *dir = opendir( directory );
+    if ( !dir ) {
+        fprintf( stderr, "Could not open %s\n", directory );
+        exit( 1 );
+    }
+    int count = 0;
+    struct dirent *entry;
+    while ( ( entry = readdir( dir ) ) && count < CORPUS_MAX_ROMS ) {
+        size_t length = strlen( entry->d_name );
+        if ( length < 4 || strcmp( entry->d_name + length - 4, ".ch8" ) ) {
+            continue;
+        }
+        paths[count] = malloc( strlen( directory ) + length + 2 );
+        sprintf( paths[count], "%s/%s", directory, entry->d_name );
+        count++;
+    }
+    closedir( dir );
+    qsort( paths, count, sizeof( char* ), corpus_compareNames );
+    return count;
+}
+
+int corpus_run( const char *romDirectory, const char *cacheDirectory,
+                uint64_t frames, uint32_t speed, uint32_t seed ) {
+    if ( strlen( cacheDirectory ) > CORPUS_MAX_DIRECTORY ) {
+        fprintf( stderr, "Cache directory path is too long: %s\n", cacheDirectory );
+        exit( 1 );
+    }
+    if ( mkdir( cacheDirectory, 0755 ) && errno != EEXIST ) {
+        fprintf( stderr, "Could not create %s\n", cacheDirectory );
+        exit( 1 );
+    }
+    static char *paths[CORPUS_MAX_ROMS];
+    int romCount = corpus_listRoms( romDirectory, paths );
+    int analysisHits = 0;
+    int runHits = 0;
+    int failed = 0;
+    uint64_t start = latency_now();
+
+    for ( int i = 0; i < romCount; ++i ) {
+        static uint8_t rom[CORPUS_MAX_ROM_BYTES];
+        size_t romLength = corpus_readRom( paths[i], rom );
+        if ( !romLength ) {
+            failed++;
+            free( paths[i] );
+            continue;
+        }
+        uint64_t romHash = corpus_hash( 0, rom, romLength );
+        char path[CORPUS_PATH_SIZE];
+
+        static struct CorpusAnalysis analysis;
+        memset( &analysis, 0, sizeof( analysis ) );
+        snprintf( path, sizeof( path ), "%s/static-%016llx.txt", cacheDirectory,
+                  ( unsigned long long ) romHash );
+        bool analysisHit = corpus_loadAnalysis( &analysis, path, romHash );
+        if ( !analysisHit ) {
+            memset( &analysis, 0, sizeof( analysis ) );
+            analysis.romHash = romHash;
+            corpus_analyze( &analysis, rom, romLength );
+            corpus_storeAnalysis( &analysis, path );
+        }
+
+        struct CorpusRun run = { 0 };
+        run.frames = frames;
+        run.speed = speed;
+        run.seed = seed;
+        run.key = corpus_hash( romHash, CH8_CORE_VERSION, strlen( CH8_CORE_VERSION ) );
+        run.key = corpus_hash( run.key, &run.frames, sizeof( run.frames ) );
+        run.key = corpus_hash( run.key, &run.speed, sizeof( run.speed ) );
+        run.key = corpus_hash( run.key, &run.seed, sizeof( run.seed ) );
+        snprintf( path, sizeof( path ), "%s/run-%016llx.txt", cacheDirectory,
+                  ( unsigned long long ) run.key );
+        bool runHit = corpus_loadRun( &run, path );
+        if ( !runHit ) {
+            run.instructions = 0;
+            run.coverage = 0;
+            run.blocked = false;
+            run.faulted = false;
+            corpus_execute( &run, rom, romLength );
+            corpus_storeRun( &run, path );
+        }
+
+        char quirks[128];
+        corpus_formatQuirks( analysis.quirks, quirks, sizeof( quirks ) );
+        printf( "Corpus: rom=%s static=%s run=%s blocks=%u%s reachable=%u%s "
+                "quirks=%s coverage=%d/%d instructions=%llu state=%016llx%s\n",
+                paths[i], analysisHit ? "cached" : "new", runHit ? "cached" : "new",
+                analysis.blockCount, analysis.truncated ? "(truncated)" : "",
+                analysis.instructions,
+                analysis.indirect ? "+" : "", quirks,
+                __builtin_popcountll( run.coverage ),
+                __builtin_popcountll( analysis.opcodes ),
+                ( unsigned long long ) run.instructions,
+                ( unsigned long long ) run.stateHash,
+                run.faulted ? " faulted" : run.blocked ? " blocked" : "" );
+        analysisHits += analysisHit;
+        runHits += runHit;
+        free( paths[i] );
+    }
+
+    printf( "Corpus: %d roms, %d/%d analyses cached, %d/%d runs cached, %.3f s\n",
+            romCount - failed, analysisHits, romCount - failed, runHits,
+            romCount - failed, ( latency_now() - start ) / 1e9 );
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ch8.h"
+
+#define CORPUS_ANALYSIS_VERSION 2 //bump when the static analysis changes
+#define CORPUS_MAX_ROMS 4096
+#define CORPUS_MAX_BLOCKS 1024
+#define CORPUS_OPCODE_CLASSES 35 //00E0 through FX65
+
+/*
+ * Opcodes that behave differently between CHIP-8 interpreters, a ROM that
+ * uses none of them runs the same everywhere
+ */
+enum CorpusQuirk {
+    QUIRK_VF_RESET = 1 << 0, //8XY1/8XY2/8XY3, whether VF is cleared
+    QUIRK_SHIFT = 1 << 1, //8XY6/8XYE, whether VY or VX is shifted
+    QUIRK_LOAD_STORE = 1 << 2, //FX55/FX65, whether I is incremented
+    QUIRK_JUMP = 1 << 3, //BNNN, whether V0 or VX is added
+    QUIRK_INDEX_OVERFLOW = 1 << 4 //FX1E, whether VF is set past 0xFFF
+};
+
+/*
+ * Straight line run of instructions, entered only at the top
+ *
+ * @member start  address of the first instruction
+ * @member length bytes in the block
+ */
+struct CorpusBlock {
+    uint16_t start;
+    uint16_t length;
+};
+
+/*
+ * What can be learned from a ROM without running it, depends only on the ROM
+ * (and CORPUS_ANALYSIS_VERSION)
+ *
+ * Code is found by following every jump, call and skip from the program start.
+ * BNNN targets can't be known, so code only reached through one is missed.
+ *
+ * @member romHash      hash of the ROM file
+ * @member blocks       blocks of reachable code, by address
+ * @member blockCount   number of elements in blocks
+ * @member instructions reachable instructions
+ * @member quirks       CorpusQuirk bits of the reachable opcodes
+ * @member opcodes      bit per opcode class reachable (corpus_opcodeClass)
+ * @member indirect     whether there is a BNNN, so code may have been missed
+ * @member truncated    whether there were more than CORPUS_MAX_BLOCKS blocks,
+ *                      so blocks is missing some
+ */
+struct CorpusAnalysis {
+    uint64_t romHash;
+    struct CorpusBlock blocks[CORPUS_MAX_BLOCKS];
+    uint32_t blockCount;
+    uint32_t instructions;
+    uint32_t quirks;
+    uint64_t opcodes;
+    bool indirect;
+    bool truncated;
+};
+
+/*
+ * Result of running a ROM headless, depends on the ROM, the core and the run
+ * parameters
+ *
+ * @member key          hash of everything the result depends on
+ * @member frames       frames run
+ * @member speed        instructionsPerSecond
+ * @member seed         seed of the random number generator
+ * @member instructions instructions run
+ * @member coverage     bit per opcode class run (corpus_opcodeClass)
+ * @member stateHash    hash of the chip at the end of the run
+ * @member blocked      whether the run ended waiting on a key
+ * @member faulted      whether the run ended on an instruction that would go
+ *                      out of memory or overflow the stack
+ */
+struct CorpusRun {
+    uint64_t key;
+    uint64_t frames;
+    uint32_t speed;
+    uint32_t seed;
+    uint64_t instructions;
+    uint64_t coverage;
+    uint64_t stateHash;
+    bool blocked;
+    bool faulted;
+};
+
+/*
+ * FNV-1a hash, can be chained by passing in the previous hash
+ *
+ * @param hash   0 to start a new hash, or the hash to continue
+ * @param data   bytes to hash
+ * @param length number of bytes
+ * @return the hash
+ */
+uint64_t corpus_hash( uint64_t hash, const void *data, size_t length );
+
+/*
+ * Hash of the architectural state of a chip (the same state lockstep.c
+ * compares)
+ *
+ * @param chip Chip8 to hash
+ * @return the hash
+ */
+uint64_t corpus_hashState( const struct Chip8 *chip );
+
+/*
+ * Which opcode class an instruction is in
+ *
+ * @param opcode instruction
+ * @return 0 to CORPUS_OPCODE_CLASSES - 1, or -1 if it isn't a valid opcode
+ */
+int corpus_opcodeClass( uint16_t opcode );
+
+/*
+ * Analyze, run and report on every .ch8 file of a directory
+ *
+ * Results are cached in cacheDirectory, one file per ROM for the static
+ * analysis and one per ROM, core and run parameters for the run. A ROM whose
+ * results are all cached is read and hashed (the hash is the cache key) but not
+ * run. The core version is CH8_CORE_VERSION, which the Makefile derives from
+ * the sources that decide what a run does (the core, corpus.c and lockstep.c).
+ *
+ * @param romDirectory   directory of ROMs
+ * @param cacheDirectory directory to keep the cache in, created if missing
+ * @param frames         frames to run every ROM for
+ * @param speed          instructionsPerSecond, 0 for the default
+ * @param seed           seed of the random number generator
+ * @return exit code
+ */
+int corpus_run( const char *romDirectory, const char *cacheDirectory,
+                uint64_t frames, uint32_t speed, uint32_t seed );
+
+#endif
@@ -0,0 +1,540 @@
+#include "gdbstub.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define GDBSTUB_REGISTERS 21
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static bool gdbstub_testBit( const uint64_t *bitmap, uint32_t address ) {
+    return ( bitmap[address / 64] >> ( address % 64 ) ) & 1;
+}
+
+static void gdbstub_setBits( uint64_t *bitmap, uint32_t address, uint32_t length,
+                             bool set ) {
+    for ( uint32_t i = address; i < address + length && i < BYTES_MEMORY; ++i ) {
+        if ( set ) {
+            bitmap[i / 64] |= 1ull << ( i % 64 );
+        } else {
+            bitmap[i / 64] &= ~( 1ull << ( i % 64 ) );
+        }
+    }
+}
+
+static int gdbstub_countBits( const uint64_t *bitmap ) {
+    int count = 0;
+    for ( int i = 0; i < GDBSTUB_BITMAP_WORDS; ++i ) {
+        count += __builtin_popcountll( bitmap[i] );
+    }
+    return count;
+}
+
+static void gdbstub_updateStopCount( struct Debugger *debugger ) {
+    debugger->stopCount = gdbstub_countBits( debugger->breakpoints ) +
+                          gdbstub_countBits( debugger->readWatch ) +
+                          gdbstub_countBits( debugger->writeWatch );
+}
+
+static int gdbstub_hexValue( char digit ) {
+    if ( digit >= '0' && digit <= '9' ) {
+        return digit - '0';
+    }
+    digit = tolower( digit );
+    if ( digit >= 'a' && digit <= 'f' ) {
+        return digit - 'a' + 10;
+    }
+    return -1;
+}
+
+static void gdbstub_disconnect( struct Debugger *debugger ) {
+    if ( debugger->clientFd >= 0 ) {
+        close( debugger->clientFd );
+    }
+    debugger->clientFd = -1;
+    debugger->inputLength = 0;
+    debugger->stopped = false;
+    debugger->stepping = false;
+    debugger->frameProgress = 0; //a partial frame is not resumed after a detach
+    memset( debugger->breakpoints, 0, sizeof( debugger->breakpoints ) );
+    memset( debugger->readWatch, 0, sizeof( debugger->readWatch ) );
+    memset( debugger->writeWatch, 0, sizeof( debugger->writeWatch ) );
+    debugger->stopCount = 0;
+}
+
+static void gdbstub_send( struct Debugger *debugger, const char *data ) {
+    char packet[GDBSTUB_BUFFER_SIZE + 4];
+    uint8_t checksum = 0;
+    if ( debugger->clientFd < 0 ) {
+        return;
+    }
+    size_t length = strlen( data );
+    packet[0] = '$';
+    memcpy( packet + 1, data, length );
+    for ( size_t i = 0; i < length; ++i ) {
+        checksum += ( uint8_t ) data[i];
+    }
+    packet[length + 1] = '#';
+    packet[length + 2] = hexDigits[checksum >> 4];
+    packet[length + 3] = hexDigits[checksum & 0xF];
+    size_t sent = 0;
+    while ( sent < length + 4 ) {
+        ssize_t result = send( debugger->clientFd, packet + sent, length + 4 - sent,
+                               MSG_NOSIGNAL );
+        if ( result < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+            //never wait forever on a client that stopped reading
+            struct pollfd pfd = { debugger->clientFd, POLLOUT, 0 };
+            if ( poll( &pfd, 1, GDBSTUB_SEND_TIMEOUT_MS ) <= 0 ) {
+                fprintf( stderr, "gdb stopped reading, dropping it\n" );
+                gdbstub_disconnect( debugger );
+                return;
+            }
+            continue;
+        }
+        if ( result < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( result <= 0 ) {
+            gdbstub_disconnect( debugger );
+            return;
+        }
+        sent += result;
+    }
+}
+
+static void gdbstub_stop( struct Debugger *debugger, const char *reply ) {
+    debugger->stopped = true;
+    debugger->stepping = false;
+    gdbstub_send( debugger, reply );
+}
+
+static uint32_t gdbstub_readRegister( struct Chip8 *chip, int number, int *size ) {
+    *size = 1;
+    if ( number >= 0 && number < 16 ) {
+        return chip->registers[number];
+    }
+    switch ( number ) {
+        case 16:
+            *size = 2;
+            return chip->indexRegister;
+        case 17:
+            *size = 2;
+            return chip->programCounter;
+        case 18:
+            *size = 2;
+            return chip->stackAddress;
+        case 19:
+            return chip->delayTimer;
+        case 20:
+            return chip->soundTimer;
+    }
+    *size = 0;
+    return 0;
+}
+
+static void gdbstub_writeRegister( struct Chip8 *chip, int number, uint32_t value ) {
+    if ( number < 16 ) {
+        chip->registers[number] = value;
+        return;
+    }
+    switch ( number ) {
+        case 16:
+            chip->indexRegister = value & 0xFFFF;
+            break;
+        case 17:
+            chip->programCounter = value % BYTES_MEMORY;
+            break;
+        case 18:
+            chip->stackAddress = value < STACK_SIZE ? value : STACK_SIZE;
+            break;
+        case 19:
+            chip->delayTimer = value;
+            break;
+        case 20:
+            chip->soundTimer = value;
+            break;
+    }
+}
+
+//little endian hex, the way registers go over the wire
+static char *gdbstub_putRegister( char *out, uint32_t value, int size ) {
+    for ( int i = 0; i < size; ++i ) {
+        uint8_t byte = value >> ( 8 * i );
+        *out++ = hexDigits[byte >> 4];
+        *out++ = hexDigits[byte & 0xF];
+    }
+    *out = '\0';
+    return out;
+}
+
+static bool gdbstub_getRegister( const char **in, int size, uint32_t *value ) {
+    *value = 0;
+    for ( int i = 0; i < size; ++i ) {
+        int high = gdbstub_hexValue( ( *in )[0] );
+        int low = high < 0 ? -1 : gdbstub_hexValue( ( *in )[1] );
+        if ( low < 0 ) {
+            return false;
+        }
+        *value |= ( uint32_t ) ( high << 4 | low ) << ( 8 * i );
+        *in += 2;
+    }
+    return true;
+}
+
+static void gdbstub_handlePacket( struct Debugger *debugger, struct Chip8 *chip,
+                                  const char *packet ) {
+    char reply[GDBSTUB_BUFFER_SIZE];
+    char *out = reply;
+    unsigned long address;
+    unsigned long length;
+    int type;
+    reply[0] = '\0';
+
+    switch ( packet[0] ) {
+        case '?':
+            strcpy( reply, "S05" );
+            break;
+        case 'g':
+            for ( int i = 0; i < GDBSTUB_REGISTERS; ++i ) {
+                int size;
+                uint32_t value = gdbstub_readRegister( chip, i, &size );
+                out = gdbstub_putRegister( out, value, size );
+            }
+            break;
+        case 'G': {
+            const char *in = packet + 1;
+            for ( int i = 0; i < GDBSTUB_REGISTERS; ++i ) {
+                int size;
+                uint32_t value;
+                gdbstub_readRegister( chip, i, &size );
+                if ( !gdbstub_getRegister( &in, size, &value ) ) {
+                    break;
+                }
+                gdbstub_writeRegister( chip, i, value );
+            }
+            strcpy( reply, "OK" );
+            break;
+        }
+        case 'p': {
+            int size;
+            uint32_t value = gdbstub_readRegister( chip, strtol( packet + 1, NULL, 16 ),
+                                                   &size );
+            if ( size ) {
+                gdbstub_putRegister( reply, value, size );
+            } else {
+                strcpy( reply, "E01" );
+            }
+            break;
+        }
+        case 'P': {
+            char *end;
+            int number = strtol( packet + 1, &end, 16 );
+            int size;
+            uint32_t value;
+            gdbstub_readRegister( chip, number, &size );
+            const char *in = end + 1;
+            if ( *end != '=' || !size || !gdbstub_getRegister( &in, size, &value ) ) {
+                strcpy( reply, "E01" );
+                break;
+            }
+            gdbstub_writeRegister( chip, number, value );
+            strcpy( reply, "OK" );
+            break;
+        }
+        case 'm':
+            if ( sscanf( packet + 1, "%lx,%lx", &address, &length ) != 2 ||
+                 address + length > BYTES_MEMORY ||
+                 length * 2 >= GDBSTUB_BUFFER_SIZE ) {
+                strcpy( reply, "E01" );
+                break;
+            }
+            for ( unsigned long i = 0; i < length; ++i ) {
+                out = gdbstub_putRegister( out, chip->memory[address + i], 1 );
+            }
+            break;
+        case 'M': {
+            const char *in = strchr( packet, ':' );
+            if ( sscanf( packet + 1, "%lx,%lx", &address, &length ) != 2 || !in ||
+                 address + length > BYTES_MEMORY ) {
+                strcpy( reply, "E01" );
+                break;
+            }
+            in++;
+            for ( unsigned long i = 0; i < length; ++i ) {
+                uint32_t value;
+                if ( !gdbstub_getRegister( &in, 1, &value ) ) {
+                    break;
+                }
+                chip->memory[address + i] = value;
+            }
+            strcpy( reply, "OK" );
+            break;
+        }
+        case 's':
+            if ( chip->keyBlocked ) {
+                //no instruction runs until a key comes, which may be never
+                strcpy( reply, "S05" );
+                break;
+            }
+            debugger->stopped = false;
+            debugger->stepping = true;
+            return; //the reply is the stop after the instruction
+        case 'c':
+            debugger->stopped = false;
+            return;
+        case 'Z':
+        case 'z':
+            if ( sscanf( packet + 1, "%d,%lx,%lx", &type, &address, &length ) != 3 ||
+                 type > 4 ) {
+                break; //empty reply, not supported
+            }
+            if ( address >= BYTES_MEMORY ) {
+                strcpy( reply, "E01" );
+                break;
+            }
+            if ( type <= 1 ) {
+                gdbstub_setBits( debugger->breakpoints, address, 1, packet[0] == 'Z' );
+            }
+            if ( type == 2 || type == 4 ) {
+                gdbstub_setBits( debugger->writeWatch, address, length, packet[0] == 'Z' );
+            }
+            if ( type == 3 || type == 4 ) {
+                gdbstub_setBits( debugger->readWatch, address, length, packet[0] == 'Z' );
+            }
+            gdbstub_updateStopCount( debugger );
+            strcpy( reply, "OK" );
+            break;
+        case 'D':
+        case 'k': //never kill the instance, it just runs on without a debugger
+            gdbstub_send( debugger, "OK" );
+            gdbstub_disconnect( debugger );
+            return;
+        case 'H':
+            strcpy( reply, "OK" );
+            break;
+        case 'q':
+            if ( !strncmp( packet, "qSupported", 10 ) ) {
+                snprintf( reply, sizeof( reply ), "PacketSize=%x", GDBSTUB_BUFFER_SIZE );
+            } else if ( !strcmp( packet, "qAttached" ) ) {
+                strcpy( reply, "1" );
+            }
+            break;
+    }
+    gdbstub_send( debugger, reply );
+}
+
+/*
+ * Pull every complete packet out of the input buffer. Anything that is not a
+ * packet is skipped, apart from 0x03 which asks the chip to stop.
+ */
+static void gdbstub_handleInput( struct Debugger *debugger, struct Chip8 *chip ) {
+    int start = 0;
+    while ( start < debugger->inputLength && debugger->clientFd >= 0 ) {
+        char *data = debugger->input + start;
+        int remaining = debugger->inputLength - start;
+        if ( data[0] == 0x03 ) {
+            if ( !debugger->stopped ) {
+                gdbstub_stop( debugger, "S02" );
+            }
+            start++;
+            continue;
+        }
+        if ( data[0] != '$' ) {
+            start++; //acks, or line noise
+            continue;
+        }
+        char *end = memchr( data, '#', remaining );
+        if ( !end || end + 2 >= data + remaining ) {
+            break; //wait for the rest of the packet
+        }
+        *end = '\0';
+        send( debugger->clientFd, "+", 1, MSG_NOSIGNAL );
+        gdbstub_handlePacket( debugger, chip, data + 1 );
+        start = end + 3 - debugger->input;
+    }
+    if ( debugger->clientFd < 0 ) {
+        return;
+    }
+    debugger->inputLength -= start;
+    memmove( debugger->input, debugger->input + start, debugger->inputLength );
+    if ( debugger->inputLength == GDBSTUB_BUFFER_SIZE ) {
+        debugger->inputLength = 0; //packet too big to ever finish
+    }
+}
+
+struct Debugger* gdbstub_initialize( const char *address ) {
+    struct Debugger *debugger = malloc( sizeof( struct Debugger ) );
+    if ( !debugger ) {
+        fprintf( stderr, "Could not create new struct Debugger\n" );
+        exit( 1 );
+    }
+    memset( debugger, 0, sizeof( struct Debugger ) );
+    debugger->clientFd = -1;
+
+    bool isPort = address[0] != '\0' && strspn( address, "0123456789" ) == strlen( address );
+    if ( isPort ) {
+        struct sockaddr_in inet = { 0 };
+        inet.sin_family = AF_INET;
+        inet.sin_port = htons( atoi( address ) );
+        inet.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        int reuse = 1;
+        debugger->listenFd = socket( AF_INET, SOCK_STREAM, 0 );
+        setsockopt( debugger->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+        if ( debugger->listenFd < 0 ||
+             bind( debugger->listenFd, ( struct sockaddr* ) &inet, sizeof( inet ) ) ) {
+            fprintf( stderr, "Could not listen for gdb on port %s\n", address );
+            exit( 1 );
+        }
+    } else {
+        struct sockaddr_un local = { 0 };
+        local.sun_family = AF_UNIX;
+        strncpy( local.sun_path, address, sizeof( local.sun_path ) - 1 );
+        unlink( address );
+        debugger->listenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( debugger->listenFd < 0 ||
+             bind( debugger->listenFd, ( struct sockaddr* ) &local, sizeof( local ) ) ) {
+            fprintf( stderr, "Could not listen for gdb on %s\n", address );
+            exit( 1 );
+        }
+    }
+    listen( debugger->listenFd, 1 );
+    fcntl( debugger->listenFd, F_SETFL, O_NONBLOCK );
+    fprintf( stderr, "Waiting for gdb on %s\n", address );
+    return debugger;
+}
+
+void gdbstub_poll( struct Debugger *debugger, struct Chip8 *chip, int timeoutMs ) {
+    struct pollfd pfd;
+    pfd.fd = debugger->clientFd >= 0 ? debugger->clientFd : debugger->listenFd;
+    pfd.events = POLLIN;
+    if ( poll( &pfd, 1, timeoutMs ) <= 0 ) {
+        return;
+    }
+
+    if ( debugger->clientFd < 0 ) {
+        debugger->clientFd = accept( debugger->listenFd, NULL, NULL );
+        if ( debugger->clientFd < 0 ) {
+            return;
+        }
+        fcntl( debugger->clientFd, F_SETFL, O_NONBLOCK );
+        debugger->stopped = true; //gdb expects a halted target when it attaches
+        debugger->resuming = true;
+        return;
+    }
+
+    ssize_t received = recv( debugger->clientFd, debugger->input + debugger->inputLength,
+                             GDBSTUB_BUFFER_SIZE - debugger->inputLength, 0 );
+    if ( received == 0 || ( received < 0 && errno != EAGAIN ) ) {
+        gdbstub_disconnect( debugger );
+        return;
+    }
+    if ( received > 0 ) {
+        debugger->inputLength += received;
+        gdbstub_handleInput( debugger, chip );
+    }
+}
+
+bool gdbstub_isRunning( struct Debugger *debugger ) {
+    return !debugger->stopped;
+}
+
+bool gdbstub_isWatching( struct Debugger *debugger ) {
+    return debugger->stopCount || debugger->stepping;
+}
+
+/*
+ * Stop reply for the memory the next instruction will touch, if that memory is
+ * watched. Only DXYN/FX33/FX55/FX65 touch memory (besides fetching).
+ */
+static const char *gdbstub_checkWatch( struct Debugger *debugger, struct Chip8 *chip,
+                                       char *reply, size_t replySize ) {
+    uint16_t opcode = chip->memory[chip->programCounter] << 8 |
+                      chip->memory[chip->programCounter + 1];
+    uint32_t length = 0;
+    const uint64_t *bitmap = debugger->readWatch;
+    const char *kind = "rwatch";
+    if ( opcode >> 12 == 0xD ) {
+        length = opcode & 0xF;
+    } else if ( opcode >> 12 == 0xF ) {
+        switch ( opcode & 0xFF ) {
+            case 0x33:
+                length = 3;
+                bitmap = debugger->writeWatch;
+                kind = "watch";
+                break;
+            case 0x55:
+                length = ( ( opcode & 0x0F00 ) >> 8 ) + 1;
+                bitmap = debugger->writeWatch;
+                kind = "watch";
+                break;
+            case 0x65:
+                length = ( ( opcode & 0x0F00 ) >> 8 ) + 1;
+                break;
+        }
+    }
+    for ( uint32_t i = chip->indexRegister;
+          i < chip->indexRegister + length && i < BYTES_MEMORY; ++i ) {
+        if ( gdbstub_testBit( bitmap, i ) ) {
+            snprintf( reply, replySize, "T05%s:%x;", kind, i );
+            return reply;
+        }
+    }
+    return NULL;
+}
+
+void gdbstub_step( struct Debugger *debugger, struct Chip8 *chip ) {
+    if ( debugger->stopped || chip->keyBlocked ) {
+        return;
+    }
+    if ( !debugger->resuming && gdbstub_testBit( debugger->breakpoints,
+                                                 chip->programCounter ) ) {
+        debugger->resuming = true;
+        gdbstub_stop( debugger, "S05" );
+        return;
+    }
+    debugger->resuming = false;
+
+    char reply[32];
+    const char *watchReply = NULL;
+    if ( debugger->stopCount ) {
+        watchReply = gdbstub_checkWatch( debugger, chip, reply, sizeof( reply ) );
+    }
+    ch8_step( chip );
+    if ( watchReply ) {
+        gdbstub_stop( debugger, watchReply );
+    } else if ( debugger->stepping ) {
+        gdbstub_stop( debugger, "S05" );
+    }
+}
+
+bool gdbstub_runFrame( struct Debugger *debugger, struct Chip8 *chip ) {
+    uint32_t instructionsPerFrame = chip->instructionsPerSecond /
+                                    chip->framesPerSecond;
+    while ( debugger->frameProgress < instructionsPerFrame && !chip->keyBlocked ) {
+        if ( debugger->stopped ) {
+            return false;
+        }
+        gdbstub_step( debugger, chip );
+        if ( !debugger->resuming ) { //not sitting on a breakpoint
+            debugger->frameProgress++;
+        }
+    }
+    debugger->frameProgress = 0;
+    ch8_tickTimers( chip );
+    return true;
+}
+
+void gdbstub_close( struct Debugger *debugger ) {
+    gdbstub_disconnect( debugger );
+    close( debugger->listenFd );
+    free( debugger );
+}
@@ -0,0 +1,122 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "ch8.h"
+
+#define GDBSTUB_BUFFER_SIZE 4096 //largest packet in either direction
+#define GDBSTUB_BITMAP_WORDS ( BYTES_MEMORY / 64 )
+#define GDBSTUB_SEND_TIMEOUT_MS 2000 //a client that reads nothing for this long
+                                     //is dropped
+
+/*
+ * GDB Remote Serial Protocol server for a single Chip8
+ *
+ * Listens on a local TCP port or Unix socket. Only one client at a time, the
+ * chip stops when it connects and carries on when it detaches (D, k or just
+ * hanging up), so it can be attached to an instance that is already running.
+ *
+ * Registers, in the order of the g/G packets (little endian):
+ *  0-15 V0-VF (8 bits), 16 I (16 bits), 17 PC (16 bits), 18 SP (16 bits,
+ *  stackAddress), 19 DT (8 bits), 20 ST (8 bits)
+ *
+ * Breakpoints (Z0/Z1) and watchpoints (Z2 write, Z3 read, Z4 access) are one
+ * bit per address. They are only looked at while at least one is set (or a
+ * step is in progress), otherwise the chip runs through the normal ch8_step
+ * loop and the debugger costs a pointer check per frame.
+ *
+ * @member listenFd      socket clients connect to
+ * @member clientFd      connected client, -1 if none
+ * @member breakpoints   bit per address, set if execution stops there
+ * @member readWatch     bit per address, set if reading it stops execution
+ * @member writeWatch    bit per address, set if writing it stops execution
+ * @member stopCount     breakpoints + watchpoints set
+ * @member stopped       whether the chip is halted for the client
+ * @member stepping      stop again after the next instruction
+ * @member resuming      PC breakpoint was just reported, don't report it twice
+ * @member frameProgress instructions already run of the current frame
+ * @member input         bytes received that aren't a full packet yet
+ * @member inputLength   number of bytes in input
+ */
+struct Debugger {
+    int listenFd;
+    int clientFd;
+    uint64_t breakpoints[GDBSTUB_BITMAP_WORDS];
+    uint64_t readWatch[GDBSTUB_BITMAP_WORDS];
+    uint64_t writeWatch[GDBSTUB_BITMAP_WORDS];
+    int stopCount;
+    bool stopped;
+    bool stepping;
+    bool resuming;
+    uint32_t frameProgress;
+    char input[GDBSTUB_BUFFER_SIZE];
+    int inputLength;
+};
+
+/*
+ * Start listening for a debugger
+ *
+ * @param address port number to listen on 127.0.0.1, or a path for a Unix
+ *                socket
+ * @return newly created Debugger
+ */
+struct Debugger* gdbstub_initialize( const char *address );
+
+/*
+ * Accept a client and handle any packets it sent
+ *
+ * Should be called once per frame, and in a loop while the chip is stopped.
+ *
+ * @param debugger  Debugger to service
+ * @param chip      Chip8 being debugged
+ * @param timeoutMs how long to wait for the client, 0 to never wait
+ */
+void gdbstub_poll( struct Debugger *debugger, struct Chip8 *chip, int timeoutMs );
+
+/*
+ * Whether the chip is allowed to run
+ *
+ * @param debugger Debugger to check
+ * @return false while the client has the chip stopped
+ */
+bool gdbstub_isRunning( struct Debugger *debugger );
+
+/*
+ * Whether instructions have to be checked one at a time
+ *
+ * @param debugger Debugger to check
+ * @return true if any breakpoint or watchpoint is set, or a step is running
+ */
+bool gdbstub_isWatching( struct Debugger *debugger );
+
+/*
+ * Run one instruction, checking breakpoints and watchpoints
+ *
+ * Does nothing if the chip is stopped. Hitting a breakpoint stops the chip
+ * before the instruction, hitting a watchpoint stops it after.
+ *
+ * @param debugger Debugger watching the chip
+ * @param chip     Chip8 to step
+ */
+void gdbstub_step( struct Debugger *debugger, struct Chip8 *chip );
+
+/*
+ * ch8_runFrame for a chip with breakpoints or watchpoints set
+ *
+ * Goes through gdbstub_step, stopping partway through the frame if needed.
+ * The rest of the frame is run next time.
+ *
+ * @param debugger Debugger watching the chip
+ * @param chip     Chip8 to run
+ * @return whether the frame was finished (and the timers ticked)
+ */
+bool gdbstub_runFrame( struct Debugger *debugger, struct Chip8 *chip );
+
+/*
+ * Disconnect any client, stop listening and free the Debugger
+ *
+ * @param debugger Debugger to free
+ */
+void gdbstub_close( struct Debugger *debugger );
+
+#endif
@@ -0,0 +1,104 @@
+#include "governor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Governor* governor_initialize( enum GovernorMode mode, uint32_t minSpeed,
+                                      uint32_t maxSpeed, const char *romPath ) {
+    struct Governor *governor = malloc( sizeof( struct Governor ) );
+    if ( !governor ) {
+        fprintf( stderr, "Could not create new struct Governor\n" );
+        exit( 1 );
+    }
+    memset( governor, 0, sizeof( struct Governor ) );
+    governor->mode = mode;
+    governor->minSpeed = minSpeed;
+    governor->maxSpeed = maxSpeed < minSpeed ? minSpeed : maxSpeed;
+    governor->romPath = romPath;
+    return governor;
+}
+
+static uint32_t governor_pickSpeed( struct Governor *governor, struct Chip8 *chip ) {
+    uint32_t speed = chip->instructionsPerSecond;
+    uint64_t busy = governor->instructions - governor->idle;
+    uint64_t busySpeed = busy * chip->framesPerSecond / governor->frames;
+    float idleFraction = governor->instructions ?
+                         ( float ) governor->idle / governor->instructions : 1;
+    //reading the timer more than once a frame is a wait loop, however long
+    bool polling = governor->timerReads >= 2 * governor->frames;
+    bool busyEveryCycle = idleFraction < 0.05 && !polling;
+
+    if ( governor->blockedFrames > governor->frames / 2 ) {
+        return speed; //waiting on a key, nothing to learn
+    }
+    if ( governor->mode == GOVERNOR_THROUGHPUT ) {
+        return busyEveryCycle ? speed : busySpeed * 5 / 4;
+    }
+    if ( busyEveryCycle &&
+         governor->draws >= GOVERNOR_DRAW_HEAVY * governor->frames ) {
+        return speed * 5 / 4;
+    }
+    if ( idleFraction > 0.5 || polling ) {
+        //step down at most 10% at a time, never below what the ROM used
+        uint64_t needed = busySpeed * 3 / 2;
+        uint32_t step = speed * 9 / 10;
+        return needed > step ? needed : step;
+    }
+    return speed;
+}
+
+void governor_endFrame( struct Governor *governor, struct Chip8 *chip ) {
+    governor->frames++;
+    governor->instructions += chip->frameInstructions;
+    governor->draws += chip->frameDraws;
+    governor->timerReads += chip->frameTimerReads;
+    governor->idle += chip->frameIdleInstructions < chip->frameInstructions ?
+                      chip->frameIdleInstructions : chip->frameInstructions;
+    governor->blockedFrames += chip->keyBlocked;
+    chip->frameInstructions = 0;
+    chip->frameDraws = 0;
+    chip->frameTimerReads = 0;
+    chip->frameIdleInstructions = 0;
+    if ( governor->frames < GOVERNOR_WINDOW ) {
+        return;
+    }
+
+    uint32_t speed = governor_pickSpeed( governor, chip );
+    if ( speed < governor->minSpeed ) {
+        speed = governor->minSpeed;
+    }
+    if ( speed > governor->maxSpeed ) {
+        speed = governor->maxSpeed;
+    }
+    if ( speed < chip->framesPerSecond ) {
+        speed = chip->framesPerSecond; //at least one instruction a frame
+    }
+    if ( speed != chip->instructionsPerSecond ) {
+        fprintf( stderr, "Governor: %s %u -> %u instructions/s (idle %.0f%%, "
+                         "%.1f draws/frame, %.1f timer reads/frame)\n",
+                 governor->romPath, chip->instructionsPerSecond, speed,
+                 governor->instructions ?
+                 100.0 * governor->idle / governor->instructions : 100.0,
+                 ( float ) governor->draws / governor->frames,
+                 ( float ) governor->timerReads / governor->frames );
+        chip->instructionsPerSecond = speed;
+        chip->secondsPerInstruction = 1.0 / speed;
+        governor->changes++;
+    }
+
+    governor->frames = 0;
+    governor->instructions = 0;
+    governor->draws = 0;
+    governor->timerReads = 0;
+    governor->idle = 0;
+    governor->blockedFrames = 0;
+}
+
+void governor_close( struct Governor *governor, struct Chip8 *chip ) {
+    //one line per ROM, in a form that is easy to store and read back
+    fprintf( stderr, "Governor: rom=%s mode=%s instructionsPerSecond=%u changes=%u\n",
+             governor->romPath,
+             governor->mode == GOVERNOR_THROUGHPUT ? "throughput" : "interactive",
+             chip->instructionsPerSecond, governor->changes );
+    free( governor );
+}
@@ -0,0 +1,86 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+#include <stdint.h>
+#include "ch8.h"
+
+#define GOVERNOR_WINDOW 30 //frames looked at before every decision
+#define GOVERNOR_DRAW_HEAVY 4 //DXYN per frame where a busy ROM counts as
+                              //sluggish rather than just uncapped
+
+/*
+ * How the governor picks a speed
+ *
+ * GOVERNOR_INTERACTIVE moves in small steps: up while a ROM is busy every
+ * cycle of the frame and drawing a lot (sluggish), down while it spends most
+ * of the frame in idle loops or polling the delay timer.
+ *
+ * GOVERNOR_THROUGHPUT is for batch runs and jumps straight to the cycles a
+ * frame actually uses plus some headroom. Cycles spent idling don't move the
+ * program forward, so cutting them is more frames per second of wall time.
+ */
+enum GovernorMode {
+    GOVERNOR_INTERACTIVE,
+    GOVERNOR_THROUGHPUT
+};
+
+/*
+ * Adjusts instructionsPerSecond of a chip from what it sees it doing
+ *
+ * @member mode          how the speed is picked
+ * @member minSpeed      lowest instructionsPerSecond it will pick
+ * @member maxSpeed      highest instructionsPerSecond it will pick
+ * @member romPath       name logged with every change, so it can be stored
+ * @member frames        frames seen in the current window
+ * @member instructions  instructions run in the current window
+ * @member draws         DXYN run in the current window
+ * @member timerReads    FX07 run in the current window
+ * @member idle          instructions spent in idle loops in the current window
+ * @member blockedFrames frames that ended waiting on FX0A in the current window
+ * @member changes       times the speed was changed
+ */
+struct Governor {
+    enum GovernorMode mode;
+    uint32_t minSpeed;
+    uint32_t maxSpeed;
+    const char *romPath;
+    uint32_t frames;
+    uint64_t instructions;
+    uint64_t draws;
+    uint64_t timerReads;
+    uint64_t idle;
+    uint32_t blockedFrames;
+    uint32_t changes;
+};
+
+/*
+ * Create a Governor
+ *
+ * @param mode     how the speed is picked
+ * @param minSpeed lowest instructionsPerSecond to pick
+ * @param maxSpeed highest instructionsPerSecond to pick
+ * @param romPath  name to log changes under
+ * @return newly created Governor
+ */
+struct Governor* governor_initialize( enum GovernorMode mode, uint32_t minSpeed,
+                                      uint32_t maxSpeed, const char *romPath );
+
+/*
+ * Take in the counters of the frame that just ended, and change the speed
+ * if a window is complete
+ *
+ * Resets the frame counters of the chip.
+ *
+ * @param governor Governor to update
+ * @param chip     Chip8 whose frame just ended
+ */
+void governor_endFrame( struct Governor *governor, struct Chip8 *chip );
+
+/*
+ * Log the speed the chip ended up at and free the Governor
+ *
+ * @param governor Governor to free
+ * @param chip     Chip8 it was governing
+ */
+void governor_close( struct Governor *governor, struct Chip8 *chip );
+
+#endif
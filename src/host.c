@@ -0,0 +1,370 @@
+#define _GNU_SOURCE //accept4
+#include "host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include "latency.h"
+
+static void host_putLittleEndian( uint8_t *dest, uint32_t value ) {
+    dest[0] = value;
+    dest[1] = value >> 8;
+    dest[2] = value >> 16;
+    dest[3] = value >> 24;
+}
+
+/*
+ * Run one frame of a session and build the delta for it, on a worker
+ */
+static void host_runSession( struct Session *session ) {
+    ch8_runFrame( &session->chip );
+    session->frame++;
+    ch8_packDisplay( &session->chip, session->packed );
+
+    uint32_t changed = 0;
+    uint8_t *row = session->delta + HOST_DELTA_HEADER;
+    for ( int y = 0; y < DISPLAY_HEIGHT; ++y ) {
+        if ( !session->sentOnce ||
+             memcmp( session->packed[y], session->sent[y], DISPLAY_ROW_BYTES ) ) {
+            changed |= 1u << y;
+            memcpy( row, session->packed[y], DISPLAY_ROW_BYTES );
+            row += DISPLAY_ROW_BYTES;
+        }
+    }
+    if ( !changed ) {
+        session->deltaLength = 0;
+        return;
+    }
+    host_putLittleEndian( session->delta, session->frame );
+    host_putLittleEndian( session->delta + 4, changed );
+    session->deltaLength = row - session->delta;
+}
+
+/*
+ * Take sessions off the batch until it is empty
+ *
+ * @return sessions run
+ */
+static uint32_t host_work( struct Host *host ) {
+    uint32_t finished = 0;
+    uint32_t i;
+    while ( ( i = __atomic_fetch_add( &host->next, 1, __ATOMIC_RELAXED ) ) <
+            host->batchCount ) {
+        host_runSession( host->batch[i] );
+        finished++;
+    }
+    return finished;
+}
+
+static void *host_workerThread( void *argument ) {
+    struct Host *host = argument;
+    uint64_t seen = 0;
+    pthread_mutex_lock( &host->lock );
+    while ( 1 ) {
+        while ( host->generation == seen && !host->closing ) {
+            pthread_cond_wait( &host->work, &host->lock );
+        }
+        if ( host->closing ) {
+            break;
+        }
+        seen = host->generation;
+        if ( !host->remaining ) {
+            continue; //woke up after the batch was over
+        }
+        host->busy++;
+        pthread_mutex_unlock( &host->lock );
+        uint32_t finished = host_work( host );
+        pthread_mutex_lock( &host->lock );
+        host->busy--;
+        host->remaining -= finished;
+        if ( !host->remaining && !host->busy ) {
+            pthread_cond_signal( &host->done );
+        }
+    }
+    pthread_mutex_unlock( &host->lock );
+    return NULL;
+}
+
+/*
+ * Run the batch on every thread and wait for it to finish
+ *
+ * The batch isn't over until no worker is still looking at it, so a slow
+ * worker can never pick up a session of the next batch early.
+ */
+static void host_runBatch( struct Host *host ) {
+    pthread_mutex_lock( &host->lock );
+    host->next = 0;
+    host->remaining = host->batchCount;
+    host->generation++;
+    pthread_cond_broadcast( &host->work );
+    pthread_mutex_unlock( &host->lock );
+
+    uint32_t finished = host_work( host );
+
+    pthread_mutex_lock( &host->lock );
+    host->remaining -= finished;
+    while ( host->remaining || host->busy ) {
+        pthread_cond_wait( &host->done, &host->lock );
+    }
+    pthread_mutex_unlock( &host->lock );
+}
+
+static void host_closeSession( struct Host *host, struct Session *session ) {
+    for ( uint32_t i = 0; i < host->sessionCount; ++i ) {
+        if ( host->sessions[i] == session ) {
+            host->sessions[i] = host->sessions[--host->sessionCount];
+            break;
+        }
+    }
+    epoll_ctl( host->epollFd, EPOLL_CTL_DEL, session->fd, NULL );
+    close( session->fd );
+    free( session );
+}
+
+static void host_accept( struct Host *host ) {
+    int fd;
+    while ( ( fd = accept4( host->listenFd, NULL, NULL, SOCK_NONBLOCK ) ) >= 0 ) {
+        if ( host->sessionCount == HOST_MAX_SESSIONS ) {
+            fprintf( stderr, "Session limit (%d) reached, refusing a client\n",
+                     HOST_MAX_SESSIONS );
+            close( fd );
+            continue;
+        }
+        struct Session *session = malloc( sizeof( struct Session ) );
+        if ( !session ) {
+            fprintf( stderr, "Could not create new struct Session\n" );
+            close( fd );
+            continue;
+        }
+        memset( session, 0, sizeof( struct Session ) );
+        session->fd = fd;
+        session->chip = host->template;
+        ch8_seedRandom( &session->chip, ( uint32_t ) time( NULL ) + host->accepted );
+
+        struct epoll_event event = { 0 };
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+        epoll_ctl( host->epollFd, EPOLL_CTL_ADD, fd, &event );
+        host->sessions[host->sessionCount++] = session;
+        host->accepted++;
+        if ( host->sessionCount > host->peakSessions ) {
+            host->peakSessions = host->sessionCount;
+        }
+    }
+}
+
+/*
+ * Read every key bitmap the client sent, and unpark the chip if one of them
+ * released its FX0A
+ */
+static void host_readKeys( struct Host *host, struct Session *session ) {
+    uint8_t message[2];
+    ssize_t received;
+    while ( ( received = recv( session->fd, message, sizeof( message ), 0 ) ) > 0 ) {
+        if ( received != sizeof( message ) ) {
+            continue;
+        }
+        bool parked = session->chip.keyBlocked;
+        ch8_setKeys( &session->chip, message[0] | message[1] << 8 );
+        if ( parked && !session->chip.keyBlocked ) {
+            //the timers kept running while the chip was parked
+            uint64_t missed = host->ticks - session->parkedTick;
+            struct Chip8 *chip = &session->chip;
+            chip->delayTimer = missed < chip->delayTimer ? chip->delayTimer - missed : 0;
+            chip->soundTimer = missed < chip->soundTimer ? chip->soundTimer - missed : 0;
+        }
+    }
+    if ( received == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) ) {
+        host_closeSession( host, session );
+    }
+}
+
+/*
+ * Run a frame of every session that isn't parked, then send the deltas
+ */
+static void host_tick( struct Host *host ) {
+    host->batchCount = 0;
+    for ( uint32_t i = 0; i < host->sessionCount; ++i ) {
+        struct Session *session = host->sessions[i];
+        if ( !session->chip.keyBlocked ) {
+            host->batch[host->batchCount++] = session;
+        }
+    }
+
+    uint64_t start = latency_now();
+    host_runBatch( host );
+    host->runSeconds += ( latency_now() - start ) / 1e9;
+    host->framesRun += host->batchCount;
+
+    for ( uint32_t i = 0; i < host->batchCount; ++i ) {
+        struct Session *session = host->batch[i];
+        if ( session->chip.keyBlocked ) {
+            //this tick's frame already ran the timers, the first one missed
+            //is the next
+            session->parkedTick = host->ticks + 1;
+        }
+        if ( !session->deltaLength ) {
+            continue;
+        }
+        ssize_t sent = send( session->fd, session->delta, session->deltaLength,
+                             MSG_DONTWAIT | MSG_NOSIGNAL );
+        if ( sent < 0 ) {
+            //a client that hung up is closed when epoll reports it, its event
+            //may still be waiting to be handled
+            host->deltasDropped++;
+        } else {
+            memcpy( session->sent, session->packed, sizeof( session->sent ) );
+            session->sentOnce = true;
+            host->deltasSent++;
+            host->bytesSent += sent;
+        }
+    }
+    host->ticks++;
+}
+
+static void host_listen( struct Host *host, const char *socketPath ) {
+    struct sockaddr_un local = { 0 };
+    local.sun_family = AF_UNIX;
+    strncpy( local.sun_path, socketPath, sizeof( local.sun_path ) - 1 );
+    unlink( socketPath );
+    host->listenFd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0 );
+    if ( host->listenFd < 0 ||
+         bind( host->listenFd, ( struct sockaddr* ) &local, sizeof( local ) ) ||
+         listen( host->listenFd, 64 ) ) {
+        fprintf( stderr, "Could not listen for sessions on %s\n", socketPath );
+        exit( 1 );
+    }
+
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &signals, NULL ); //workers inherit the mask
+    host->signalFd = signalfd( -1, &signals, SFD_NONBLOCK );
+
+    uint64_t interval = 1000000000ull / host->template.framesPerSecond;
+    struct itimerspec tick = { { 0, interval }, { 0, interval } };
+    host->timerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+    timerfd_settime( host->timerFd, 0, &tick, NULL );
+
+    host->epollFd = epoll_create1( 0 );
+    if ( host->signalFd < 0 || host->timerFd < 0 || host->epollFd < 0 ) {
+        fprintf( stderr, "Could not set up the host event loop\n" );
+        exit( 1 );
+    }
+    //the loop tells its own fds apart from sessions by the address of the field
+    int *fds[3] = { &host->listenFd, &host->timerFd, &host->signalFd };
+    for ( int i = 0; i < 3; ++i ) {
+        struct epoll_event event = { 0 };
+        event.events = EPOLLIN;
+        event.data.ptr = fds[i];
+        epoll_ctl( host->epollFd, EPOLL_CTL_ADD, *fds[i], &event );
+    }
+}
+
+static void host_printStats( struct Host *host ) {
+    fprintf( stderr, "Host: %llu sessions (peak %u), %u threads, %llu ticks "
+                     "(%llu late), %llu frames, %.3f ms run/tick\n",
+             ( unsigned long long ) host->accepted, host->peakSessions,
+             host->threadCount + 1, ( unsigned long long ) host->ticks,
+             ( unsigned long long ) host->lateTicks,
+             ( unsigned long long ) host->framesRun,
+             host->ticks ? host->runSeconds * 1e3 / host->ticks : 0.0 );
+    fprintf( stderr, "Host: %llu deltas sent (%llu bytes), %llu dropped\n",
+             ( unsigned long long ) host->deltasSent,
+             ( unsigned long long ) host->bytesSent,
+             ( unsigned long long ) host->deltasDropped );
+}
+
+int host_run( const char *socketPath, const char *romPath, uint32_t threads,
+              uint32_t speed ) {
+    struct Host *host = malloc( sizeof( struct Host ) );
+    if ( !host ) {
+        fprintf( stderr, "Could not create new struct Host\n" );
+        exit( 1 );
+    }
+    memset( host, 0, sizeof( struct Host ) );
+
+    struct Chip8 *template = ch8_initializeHeadless();
+    ch8_initializeFonts( template, 0x50 );
+    ch8_loadFileIntoMemory( template, romPath );
+    if ( speed ) {
+        template->instructionsPerSecond = speed;
+        template->secondsPerInstruction = 1.0 / speed;
+    }
+    host->template = *template;
+    free( template );
+
+    host_listen( host, socketPath );
+    pthread_mutex_init( &host->lock, NULL );
+    pthread_cond_init( &host->work, NULL );
+    pthread_cond_init( &host->done, NULL );
+    if ( threads > HOST_MAX_THREADS ) {
+        threads = HOST_MAX_THREADS;
+    }
+    for ( uint32_t i = 1; i < threads; ++i ) {
+        if ( pthread_create( &host->threads[host->threadCount], NULL,
+                             host_workerThread, host ) ) {
+            fprintf( stderr, "Could not start host worker thread\n" );
+            exit( 1 );
+        }
+        host->threadCount++;
+    }
+    fprintf( stderr, "Serving %s on %s\n", romPath, socketPath );
+
+    struct epoll_event events[64];
+    bool running = true;
+    while ( running ) {
+        int count = epoll_wait( host->epollFd, events, 64, -1 );
+        for ( int i = 0; i < count && running; ++i ) {
+            void *source = events[i].data.ptr;
+            if ( source == &host->listenFd ) {
+                host_accept( host );
+            } else if ( source == &host->signalFd ) {
+                running = false;
+            } else if ( source == &host->timerFd ) {
+                uint64_t expirations = 0;
+                if ( read( host->timerFd, &expirations, sizeof( expirations ) ) > 0 ) {
+                    //run one frame however far behind, sessions slow down
+                    //instead of running a burst of frames
+                    host->lateTicks += expirations - 1;
+                    host_tick( host );
+                }
+            } else {
+                host_readKeys( host, source );
+            }
+        }
+    }
+
+    pthread_mutex_lock( &host->lock );
+    host->closing = true;
+    pthread_cond_broadcast( &host->work );
+    pthread_mutex_unlock( &host->lock );
+    for ( uint32_t i = 0; i < host->threadCount; ++i ) {
+        pthread_join( host->threads[i], NULL );
+    }
+    host_printStats( host );
+
+    while ( host->sessionCount ) {
+        host_closeSession( host, host->sessions[0] );
+    }
+    close( host->listenFd );
+    close( host->timerFd );
+    close( host->signalFd );
+    close( host->epollFd );
+    unlink( socketPath );
+    pthread_mutex_destroy( &host->lock );
+    pthread_cond_destroy( &host->work );
+    pthread_cond_destroy( &host->done );
+    free( host );
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef HOST_H
+#define HOST_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ch8.h"
+
+#define HOST_MAX_SESSIONS 1024
+#define HOST_MAX_THREADS 64
+#define HOST_DELTA_HEADER 8 //frame number and changed row mask, both uint32
+#define HOST_DELTA_BYTES ( HOST_DELTA_HEADER + DISPLAY_HEIGHT * DISPLAY_ROW_BYTES )
+
+/*
+ * One client attached to the host, and the chip it drives
+ *
+ * A session is a coroutine that yields at every frame boundary: the host runs
+ * one ch8_runFrame of it per 60 Hz tick, on whichever thread picks it up. A
+ * chip blocked on FX0A is parked, it is not scheduled at all until a key
+ * bitmap arrives that releases it.
+ *
+ * Messages are datagrams on a SOCK_SEQPACKET socket. The client sends the keys
+ * it holds as a 2 byte little endian bitmap (bit 0 is key 0). The host sends a
+ * delta after every frame that changed the display: the frame number and a
+ * mask of the rows that changed (both uint32, little endian), then
+ * DISPLAY_ROW_BYTES packed bytes (see ch8_packDisplay) for each row in the
+ * mask, top to bottom. The first delta has every row.
+ *
+ * @member fd         socket of the client
+ * @member chip       the chip, copied from the host's template
+ * @member sent       display the client has, deltas are against it
+ * @member sentOnce   whether the client has been sent a full frame yet
+ * @member packed     display as of the last frame run
+ * @member delta      message built from packed and sent, by the worker that
+ *                    ran the frame
+ * @member deltaLength bytes in delta, 0 if nothing changed
+ * @member frame      frames run
+ * @member parkedTick first tick the chip sat out blocked on FX0A (the tick it
+ *                   blocked in already ran its timers)
+ */
+struct Session {
+    int fd;
+    struct Chip8 chip;
+    uint8_t sent[DISPLAY_HEIGHT][DISPLAY_ROW_BYTES];
+    bool sentOnce;
+    uint8_t packed[DISPLAY_HEIGHT][DISPLAY_ROW_BYTES];
+    uint8_t delta[HOST_DELTA_BYTES];
+    uint32_t deltaLength;
+    uint32_t frame;
+    uint64_t parkedTick;
+};
+
+/*
+ * Runs many sessions in one process
+ *
+ * Everything but running frames happens on the main thread, in an epoll loop
+ * over the listening socket, the clients, a 60 Hz timerfd and a signalfd for
+ * SIGINT/SIGTERM. Every tick the sessions that aren't parked go in a batch,
+ * and the batch is run by the worker threads and the main thread together,
+ * each taking the next session off the batch until it is empty. Deltas are
+ * sent once the whole batch is done, without blocking: a client that can't
+ * keep up misses frames, and gets the rows that changed since what it has
+ * when it can.
+ *
+ * @member template     chip with the ROM loaded, copied into every session
+ * @member listenFd     socket clients connect to
+ * @member epollFd      epoll instance everything is waited on with
+ * @member timerFd      60 Hz tick
+ * @member signalFd     SIGINT/SIGTERM, to stop and print the stats
+ * @member sessions     attached sessions
+ * @member sessionCount number of elements in sessions
+ * @member batch        sessions to run this tick
+ * @member batchCount   number of elements in batch
+ * @member next         index of the next session in batch to run
+ * @member remaining    sessions in batch not finished yet
+ * @member busy         workers still looking at batch
+ * @member generation   batches started, workers wait for it to change
+ * @member closing      whether the workers should exit
+ * @member lock         guards remaining, busy, generation and closing
+ * @member work         signalled when a batch is started
+ * @member done         signalled when a batch is finished
+ * @member threads      worker threads, the main thread is not in here
+ * @member threadCount  number of elements in threads
+ * @member ticks        ticks handled
+ * @member lateTicks    ticks that were missed because a tick took too long
+ * @member accepted     sessions accepted
+ * @member peakSessions most sessions attached at once
+ * @member framesRun    frames run over every session
+ * @member deltasSent   deltas sent
+ * @member deltasDropped deltas not sent because the client wasn't reading
+ * @member bytesSent    bytes of deltas sent
+ * @member runSeconds   time spent running batches
+ */
+struct Host {
+    struct Chip8 template;
+    int listenFd;
+    int epollFd;
+    int timerFd;
+    int signalFd;
+    struct Session *sessions[HOST_MAX_SESSIONS];
+    uint32_t sessionCount;
+    struct Session *batch[HOST_MAX_SESSIONS];
+    uint32_t batchCount;
+    uint32_t next;
+    uint32_t remaining;
+    uint32_t busy;
+    uint64_t generation;
+    bool closing;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t threads[HOST_MAX_THREADS];
+    uint32_t threadCount;
+    uint64_t ticks;
+    uint64_t lateTicks;
+    uint64_t accepted;
+    uint32_t peakSessions;
+    uint64_t framesRun;
+    uint64_t deltasSent;
+    uint64_t deltasDropped;
+    uint64_t bytesSent;
+    double runSeconds;
+};
+
+/*
+ * Serve sessions of a ROM on a Unix socket until SIGINT/SIGTERM
+ *
+ * @param socketPath path of the SOCK_SEQPACKET socket to listen on
+ * @param romPath    program every session runs
+ * @param threads    threads to run frames on, the main thread included
+ * @param speed      instructionsPerSecond of every session, 0 for the default
+ * @return exit code
+ */
+int host_run( const char *socketPath, const char *romPath, uint32_t threads,
+              uint32_t speed );
+
+#endif
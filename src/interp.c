@@ -0,0 +1,201 @@
+#include "interp.h"
+#include <assert.h>
+#include <string.h>
+
+#define X ( ( opcode & 0x0F00 ) >> 8 )
+#define Y ( ( opcode & 0x00F0 ) >> 4 )
+#define N ( opcode & 0x000F )
+#define NN ( opcode & 0x00FF )
+#define NNN ( opcode & 0x0FFF )
+
+typedef void ( *interp_handler )( struct Chip8 *chip, uint16_t opcode );
+
+static void interp_system( struct Chip8 *chip, uint16_t opcode ) {
+    if ( opcode == 0x00E0 ) {
+        ch8_clearScreen( chip );
+    } else if ( opcode == 0x00EE ) {
+        assert( chip->stackAddress > 0 );
+        chip->programCounter = chip->stack[--chip->stackAddress];
+    }
+}
+
+static void interp_jump( struct Chip8 *chip, uint16_t opcode ) {
+    uint16_t from = chip->programCounter - 2;
+    if ( NNN <= from && from - NNN <= IDLE_LOOP_BYTES ) {
+        chip->frameIdleInstructions += ( from - NNN ) / 2 + 1;
+    }
+    chip->programCounter = NNN;
+}
+
+static void interp_call( struct Chip8 *chip, uint16_t opcode ) {
+    assert( chip->stackAddress < STACK_SIZE );
+    chip->stack[chip->stackAddress++] = chip->programCounter;
+    chip->programCounter = NNN;
+}
+
+static void interp_skipEqual( struct Chip8 *chip, uint16_t opcode ) {
+    chip->programCounter += ( chip->registers[X] == NN ) << 1;
+}
+
+static void interp_skipNotEqual( struct Chip8 *chip, uint16_t opcode ) {
+    chip->programCounter += ( chip->registers[X] != NN ) << 1;
+}
+
+static void interp_skipRegistersEqual( struct Chip8 *chip, uint16_t opcode ) {
+    chip->programCounter += ( chip->registers[X] == chip->registers[Y] ) << 1;
+}
+
+static void interp_set( struct Chip8 *chip, uint16_t opcode ) {
+    chip->registers[X] = NN;
+}
+
+static void interp_add( struct Chip8 *chip, uint16_t opcode ) {
+    chip->registers[X] += NN;
+}
+
+//VF is always written before VX, same as the reference, so 8FYN matches
+static void interp_arithmetic( struct Chip8 *chip, uint16_t opcode ) {
+    uint8_t *v = chip->registers;
+    switch ( N ) {
+        case 0x0:
+            v[X] = v[Y];
+            break;
+        case 0x1:
+            v[X] |= v[Y];
+            break;
+        case 0x2:
+            v[X] &= v[Y];
+            break;
+        case 0x3:
+            v[X] ^= v[Y];
+            break;
+        case 0x4:
+            v[0xF] = 255 - v[X] < v[Y];
+            v[X] = v[X] + v[Y];
+            break;
+        case 0x5:
+            v[0xF] = v[X] > v[Y];
+            v[X] = v[X] - v[Y];
+            break;
+        case 0x6:
+            v[0xF] = v[X] & 1;
+            v[X] >>= 1;
+            break;
+        case 0x7:
+            v[0xF] = v[Y] > v[X];
+            v[X] = v[Y] - v[X];
+            break;
+        case 0xE:
+            v[0xF] = v[X] & 0x80;
+            v[X] <<= 1;
+            break;
+    }
+}
+
+static void interp_skipRegistersNotEqual( struct Chip8 *chip, uint16_t opcode ) {
+    chip->programCounter += ( chip->registers[X] != chip->registers[Y] ) << 1;
+}
+
+static void interp_setIndex( struct Chip8 *chip, uint16_t opcode ) {
+    chip->indexRegister = NNN;
+}
+
+static void interp_jumpOffset( struct Chip8 *chip, uint16_t opcode ) {
+    chip->programCounter = NNN + chip->registers[0x0];
+}
+
+static void interp_random( struct Chip8 *chip, uint16_t opcode ) {
+    chip->registers[X] = ch8_random( chip ) & NN;
+}
+
+static void interp_sprite( struct Chip8 *chip, uint16_t opcode ) {
+    uint8_t xPos = chip->registers[X] % DISPLAY_WIDTH;
+    uint8_t yPos = chip->registers[Y] % DISPLAY_HEIGHT;
+    int columns = DISPLAY_WIDTH - xPos < 8 ? DISPLAY_WIDTH - xPos : 8;
+    uint8_t collision = 0;
+    for ( int i = 0; i < N && yPos + i < DISPLAY_HEIGHT; ++i ) {
+        assert( chip->indexRegister + i < BYTES_MEMORY );
+        uint8_t spriteByte = chip->memory[chip->indexRegister + i];
+        for ( int j = 0; j < columns; ++j ) {
+            if ( ( spriteByte >> ( 7 - j ) ) & 1 ) {
+                bool *pixel = &chip->display[xPos + j][yPos + i];
+                collision |= *pixel;
+                *pixel = !*pixel;
+            }
+        }
+    }
+    chip->registers[0xF] = collision;
+    chip->frameDraws++;
+}
+
+static void interp_key( struct Chip8 *chip, uint16_t opcode ) {
+    switch ( Y ) {
+        case 0x9:
+            if ( ( chip->keys >> ( chip->registers[X] & 0xF ) ) & 1 ) {
+                chip->programCounter += 2;
+            }
+            break;
+        case 0xA:
+            if ( !( ( chip->keys >> ( chip->registers[X] & 0xF ) ) & 1 ) ) {
+                chip->programCounter += 2;
+            }
+            break;
+    }
+}
+
+static void interp_misc( struct Chip8 *chip, uint16_t opcode ) {
+    uint8_t *v = chip->registers;
+    switch ( NN ) {
+        case 0x07:
+            v[X] = chip->delayTimer;
+            chip->frameTimerReads++;
+            break;
+        case 0x15:
+            chip->delayTimer = v[X];
+            break;
+        case 0x18:
+            chip->soundTimer = v[X];
+            break;
+        case 0x1E:
+            chip->indexRegister += v[X];
+            v[0xF] = chip->indexRegister > 0x1000;
+            break;
+        case 0x0A:
+            chip->keyBlocked = 1;
+            chip->programCounter -= 2;
+            break;
+        case 0x29:
+            chip->indexRegister = chip->startingFontAddress + ( v[X] & 0x0F ) * 5;
+            break;
+        case 0x33:
+            chip->memory[chip->indexRegister] = v[X] / 100;
+            chip->memory[chip->indexRegister + 1] = v[X] / 10 % 10;
+            chip->memory[chip->indexRegister + 2] = v[X] % 10;
+            break;
+        case 0x55:
+            memcpy( &chip->memory[chip->indexRegister], v, X + 1 );
+            break;
+        case 0x65:
+            memcpy( v, &chip->memory[chip->indexRegister], X + 1 );
+            break;
+    }
+}
+
+static const interp_handler handlers[16] = {
+    interp_system, interp_jump, interp_call, interp_skipEqual,
+    interp_skipNotEqual, interp_skipRegistersEqual, interp_set, interp_add,
+    interp_arithmetic, interp_skipRegistersNotEqual, interp_setIndex,
+    interp_jumpOffset, interp_random, interp_sprite, interp_key, interp_misc
+};
+
+void interp_step( struct Chip8 *chip ) {
+    if ( chip->keyBlocked ) {
+        return;
+    }
+    uint16_t opcode = chip->memory[chip->programCounter] << 8 |
+                      chip->memory[chip->programCounter + 1];
+    chip->currentInstruction = opcode;
+    chip->programCounter += 2;
+    chip->frameInstructions++;
+    handlers[opcode >> 12]( chip, opcode );
+}
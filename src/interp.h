@@ -0,0 +1,27 @@
+#ifndef INTERP_H
+#define INTERP_H
+#include "ch8.h"
+
+/*
+ * Table dispatched interpreter, a second execution backend for Chip8
+ *
+ * Instructions are dispatched through a table of handlers indexed by the first
+ * nibble, and the operands are decoded into locals instead of being written
+ * into the option fields of the chip. Only currentInstruction is kept up to
+ * date, since a blocked FX0A needs it.
+ *
+ * It must behave exactly like ch8_step (quirks included), lockstep.c checks
+ * that it does. It does not call the Latency hooks, it is never used for a
+ * chip with a Screen.
+ */
+
+/*
+ * Fetch and execute the next instruction right away
+ *
+ * Drop in replacement for ch8_step.
+ *
+ * @param chip Chip8 to step
+ */
+void interp_step( struct Chip8 *chip );
+
+#endif
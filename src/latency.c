@@ -0,0 +1,171 @@
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HISTOGRAM_HALF ( 1 << ( HISTOGRAM_SUB_BITS - 1 ) )
+
+uint64_t latency_now() {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static int histogram_index( uint64_t value ) {
+    if ( value < ( 1u << HISTOGRAM_SUB_BITS ) ) {
+        return value;
+    }
+    //keep the top HISTOGRAM_SUB_BITS bits of the value
+    int shift = 63 - __builtin_clzll( value ) - ( HISTOGRAM_SUB_BITS - 1 );
+    return HISTOGRAM_HALF * shift + ( value >> shift );
+}
+
+static uint64_t histogram_value( int index ) {
+    if ( index < ( 1 << HISTOGRAM_SUB_BITS ) ) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_HALF - 1;
+    return ( uint64_t ) ( index - HISTOGRAM_HALF * shift ) << shift;
+}
+
+void histogram_record( struct Histogram *histogram, uint64_t value ) {
+    histogram->counts[histogram_index( value )]++;
+    if ( !histogram->count || value < histogram->min ) {
+        histogram->min = value;
+    }
+    if ( value > histogram->max ) {
+        histogram->max = value;
+    }
+    histogram->count++;
+    histogram->sum += value;
+}
+
+uint64_t histogram_percentile( const struct Histogram *histogram, double percentile ) {
+    uint64_t target = histogram->count * percentile / 100;
+    if ( target == 0 ) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for ( int i = 0; i < HISTOGRAM_BUCKETS; ++i ) {
+        seen += histogram->counts[i];
+        if ( seen >= target ) {
+            //a bucket's low end can be below everything that went in it
+            uint64_t value = histogram_value( i );
+            return value < histogram->min ? histogram->min : value;
+        }
+    }
+    return 0;
+}
+
+static void histogram_print( const struct Histogram *histogram ) {
+    if ( !histogram->count ) {
+        fprintf( stderr, "  %-18s no samples\n", histogram->name );
+        return;
+    }
+    fprintf( stderr, "  %-18s n=%-8llu min %9.3f  mean %9.3f  p50 %9.3f  "
+                     "p90 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f ms\n",
+             histogram->name, ( unsigned long long ) histogram->count,
+             histogram->min / 1e6, ( double ) histogram->sum / histogram->count / 1e6,
+             histogram_percentile( histogram, 50 ) / 1e6,
+             histogram_percentile( histogram, 90 ) / 1e6,
+             histogram_percentile( histogram, 99 ) / 1e6,
+             histogram_percentile( histogram, 99.9 ) / 1e6,
+             histogram->max / 1e6 );
+}
+
+struct Latency* latency_initialize( uint32_t framesPerSecond, double dumpIntervalSeconds ) {
+    struct Latency *latency = malloc( sizeof( struct Latency ) );
+    if ( !latency ) {
+        fprintf( stderr, "Could not create new struct Latency\n" );
+        exit( 1 );
+    }
+    memset( latency, 0, sizeof( struct Latency ) );
+    latency->inputToObserve.name = "input->observe";
+    latency->inputToChange.name = "input->change";
+    latency->inputToPresent.name = "input->present";
+    latency->frameInterval.name = "frame interval";
+    latency->frameJitter.name = "frame jitter";
+    latency->timerDrift.name = "timer drift";
+    latency->framesPerSecond = framesPerSecond;
+    latency->dumpInterval = dumpIntervalSeconds * 1e9;
+    latency->lastDump = latency_now();
+    return latency;
+}
+
+void latency_keyEvent( struct Latency *latency ) {
+    uint64_t now = latency_now();
+    if ( latency->stage != LATENCY_IDLE &&
+         now - latency->keyTime > LATENCY_GIVE_UP_NS ) {
+        latency->unanswered++;
+        latency->stage = LATENCY_IDLE;
+    }
+    if ( latency->stage == LATENCY_IDLE ) {
+        latency->keyTime = now;
+        latency->stage = LATENCY_OBSERVE;
+    }
+}
+
+void latency_keyObserved( struct Latency *latency ) {
+    if ( latency->stage == LATENCY_OBSERVE ) {
+        histogram_record( &latency->inputToObserve, latency_now() - latency->keyTime );
+        latency->stage = LATENCY_CHANGE;
+    }
+}
+
+void latency_displayChanged( struct Latency *latency ) {
+    if ( latency->stage == LATENCY_CHANGE ) {
+        histogram_record( &latency->inputToChange, latency_now() - latency->keyTime );
+        latency->stage = LATENCY_PRESENT;
+    }
+}
+
+void latency_present( struct Latency *latency ) {
+    uint64_t now = latency_now();
+    uint64_t ideal = 1000000000ull / latency->framesPerSecond;
+    if ( latency->lastPresent ) {
+        uint64_t interval = now - latency->lastPresent;
+        histogram_record( &latency->frameInterval, interval );
+        histogram_record( &latency->frameJitter,
+                          interval > ideal ? interval - ideal : ideal - interval );
+    }
+    latency->lastPresent = now;
+
+    if ( latency->stage == LATENCY_PRESENT ) {
+        histogram_record( &latency->inputToPresent, now - latency->keyTime );
+        latency->stage = LATENCY_IDLE;
+    }
+
+    if ( latency->dumpInterval && now - latency->lastDump >= latency->dumpInterval ) {
+        latency->lastDump = now;
+        latency_printStats( latency );
+    }
+}
+
+void latency_timerTick( struct Latency *latency ) {
+    uint64_t now = latency_now();
+    if ( !latency->firstTick ) {
+        latency->firstTick = now;
+        return;
+    }
+    latency->ticks++;
+    uint64_t expected = latency->firstTick +
+                        latency->ticks * 1000000000ull / latency->framesPerSecond;
+    histogram_record( &latency->timerDrift,
+                      now > expected ? now - expected : expected - now );
+}
+
+void latency_printStats( struct Latency *latency ) {
+    fprintf( stderr, "Latency (%llu key presses dropped without a reaction):\n",
+             ( unsigned long long ) latency->unanswered );
+    histogram_print( &latency->inputToObserve );
+    histogram_print( &latency->inputToChange );
+    histogram_print( &latency->inputToPresent );
+    histogram_print( &latency->frameInterval );
+    histogram_print( &latency->frameJitter );
+    histogram_print( &latency->timerDrift );
+}
+
+void latency_free( struct Latency *latency ) {
+    free( latency );
+}
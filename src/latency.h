@@ -0,0 +1,174 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HISTOGRAM_SUB_BITS 6 //linear buckets per power of two is
+                             //2^(HISTOGRAM_SUB_BITS - 1), ~3% resolution
+#define HISTOGRAM_BUCKETS ( ( 64 - HISTOGRAM_SUB_BITS + 2 ) << ( HISTOGRAM_SUB_BITS - 1 ) )
+#define LATENCY_GIVE_UP_NS 2000000000ull //a key the ROM hasn't reacted to in
+                                         //this long is dropped
+
+/*
+ * HDR style histogram of nanosecond values
+ *
+ * Values below 2^HISTOGRAM_SUB_BITS get a bucket each, above that every power
+ * of two is split into the same number of linear buckets, so the relative
+ * error is the same from nanoseconds to seconds and recording is a couple of
+ * shifts.
+ *
+ * @member name    printed in front of the stats
+ * @member counts  values recorded in each bucket
+ * @member count   values recorded
+ * @member sum     sum of the values recorded, for the mean
+ * @member min     smallest value recorded
+ * @member max     largest value recorded
+ */
+struct Histogram {
+    const char *name;
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+/*
+ * Where a key press is along the way to the screen
+ */
+enum LatencyStage {
+    LATENCY_IDLE, //no key being followed
+    LATENCY_OBSERVE, //waiting on EX9E/EXA1/FX0A to look at the keys
+    LATENCY_CHANGE, //waiting on the display to change
+    LATENCY_PRESENT //waiting on SDL_RenderPresent
+};
+
+/*
+ * Follows key presses from SDL to the screen, and keeps track of how evenly
+ * frames are presented and timers tick. Timestamps come from CLOCK_MONOTONIC.
+ *
+ * Only one key press is followed at a time, presses while one is in flight
+ * are not measured.
+ *
+ * @member inputToObserve time from the SDL event to the first instruction
+ *                        that looks at the keys
+ * @member inputToChange  time from the SDL event to the next display change
+ *                        after that
+ * @member inputToPresent time from the SDL event to the present after that
+ * @member frameInterval  time between presents
+ * @member frameJitter    distance of every frame interval from the ideal one
+ * @member timerDrift     distance of every timer tick from the ideal 60 Hz
+ *                        schedule started at the first tick
+ * @member stage          where the followed key press is
+ * @member keyTime        when the followed key press was received
+ * @member lastPresent    when the last frame was presented, 0 if never
+ * @member firstTick      when the timers first ticked, 0 if never
+ * @member ticks          timer ticks since firstTick
+ * @member unanswered     key presses dropped after LATENCY_GIVE_UP_NS
+ * @member framesPerSecond ideal present and timer rate
+ * @member dumpInterval   nanoseconds between stats dumps, 0 for only on exit
+ * @member lastDump       when the stats were last dumped
+ */
+struct Latency {
+    struct Histogram inputToObserve;
+    struct Histogram inputToChange;
+    struct Histogram inputToPresent;
+    struct Histogram frameInterval;
+    struct Histogram frameJitter;
+    struct Histogram timerDrift;
+    enum LatencyStage stage;
+    uint64_t keyTime;
+    uint64_t lastPresent;
+    uint64_t firstTick;
+    uint64_t ticks;
+    uint64_t unanswered;
+    uint32_t framesPerSecond;
+    uint64_t dumpInterval;
+    uint64_t lastDump;
+};
+
+/*
+ * Current CLOCK_MONOTONIC time
+ *
+ * @return nanoseconds
+ */
+uint64_t latency_now();
+
+/*
+ * Add a value to a histogram
+ *
+ * @param histogram Histogram to add to
+ * @param value     value to add, in nanoseconds
+ */
+void histogram_record( struct Histogram *histogram, uint64_t value );
+
+/*
+ * Smallest value that at least a fraction of the values are at or below
+ *
+ * @param histogram  Histogram to look in
+ * @param percentile 0 to 100
+ * @return the value (the low end of its bucket), 0 if the histogram is empty
+ */
+uint64_t histogram_percentile( const struct Histogram *histogram, double percentile );
+
+/*
+ * Create a Latency
+ *
+ * @param framesPerSecond   ideal present and timer rate
+ * @param dumpIntervalSeconds seconds between stats dumps, 0 for only on exit
+ * @return newly created Latency
+ */
+struct Latency* latency_initialize( uint32_t framesPerSecond, double dumpIntervalSeconds );
+
+/*
+ * A key was pressed or released (SDL event received)
+ *
+ * @param latency Latency to record into
+ */
+void latency_keyEvent( struct Latency *latency );
+
+/*
+ * An instruction looked at the keys (EX9E, EXA1, or FX0A being released)
+ *
+ * @param latency Latency to record into
+ */
+void latency_keyObserved( struct Latency *latency );
+
+/*
+ * The display was changed (DXYN or 00E0)
+ *
+ * @param latency Latency to record into
+ */
+void latency_displayChanged( struct Latency *latency );
+
+/*
+ * A frame was just presented (SDL_RenderPresent returned)
+ *
+ * Also dumps the stats when the dump interval has passed.
+ *
+ * @param latency Latency to record into
+ */
+void latency_present( struct Latency *latency );
+
+/*
+ * The delay/sound timers just ticked
+ *
+ * @param latency Latency to record into
+ */
+void latency_timerTick( struct Latency *latency );
+
+/*
+ * Print every histogram to stderr
+ *
+ * @param latency Latency to print
+ */
+void latency_printStats( struct Latency *latency );
+
+/*
+ * Free a Latency
+ *
+ * @param latency Latency to free
+ */
+void latency_free( struct Latency *latency );
+
+#endif
@@ -0,0 +1,287 @@
+#include "lockstep.h"
+#include "interp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DIFF_LINES 8 //memory/display differences printed before giving up
+
+static const struct Backend backends[] = {
+    { "reference", ch8_step },
+    { "table", interp_step },
+};
+
+const struct Backend* lockstep_findBackend( const char *name ) {
+    for ( size_t i = 0; i < sizeof( backends ) / sizeof( backends[0] ); ++i ) {
+        if ( !strcmp( backends[i].name, name ) ) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+bool lockstep_isSafe( const struct Chip8 *chip ) {
+    if ( chip->programCounter > BYTES_MEMORY - 2 ) {
+        return false;
+    }
+    uint16_t opcode = chip->memory[chip->programCounter] << 8 |
+                      chip->memory[chip->programCounter + 1];
+    uint8_t x = ( opcode & 0x0F00 ) >> 8;
+    switch ( opcode >> 12 ) {
+        case 0x0:
+            return opcode != 0x00EE || chip->stackAddress > 0;
+        case 0x2:
+            return chip->stackAddress < STACK_SIZE;
+        case 0xD:
+            return chip->indexRegister + ( opcode & 0xF ) <= BYTES_MEMORY;
+        case 0xF:
+            switch ( opcode & 0xFF ) {
+                case 0x33:
+                    return chip->indexRegister + 3 <= BYTES_MEMORY;
+                case 0x55:
+                case 0x65:
+                    return chip->indexRegister + x + 1 <= BYTES_MEMORY;
+            }
+            return true;
+    }
+    return true;
+}
+
+static bool lockstep_sameState( const struct Chip8 *a, const struct Chip8 *b ) {
+    return !memcmp( a->registers, b->registers, sizeof( a->registers ) ) &&
+           a->indexRegister == b->indexRegister &&
+           a->programCounter == b->programCounter &&
+           a->stackAddress == b->stackAddress &&
+           !memcmp( a->stack, b->stack, sizeof( a->stack ) ) &&
+           a->delayTimer == b->delayTimer &&
+           a->soundTimer == b->soundTimer &&
+           a->keyBlocked == b->keyBlocked &&
+           a->randomState == b->randomState &&
+           !memcmp( a->memory, b->memory, sizeof( a->memory ) ) &&
+           !memcmp( a->display, b->display, sizeof( a->display ) );
+}
+
+static void lockstep_printDiff( const struct Chip8 *a, const struct Chip8 *b ) {
+    for ( int i = 0; i < 16; ++i ) {
+        if ( a->registers[i] != b->registers[i] ) {
+            printf( "\tV%X: %02x != %02x\n", i, a->registers[i], b->registers[i] );
+        }
+    }
+    if ( a->indexRegister != b->indexRegister ) {
+        printf( "\tI: %03x != %03x\n", a->indexRegister, b->indexRegister );
+    }
+    if ( a->programCounter != b->programCounter ) {
+        printf( "\tPC: %03x != %03x\n", a->programCounter, b->programCounter );
+    }
+    if ( a->stackAddress != b->stackAddress ) {
+        printf( "\tStack Address: %u != %u\n", a->stackAddress, b->stackAddress );
+    }
+    for ( int i = 0; i < STACK_SIZE; ++i ) {
+        if ( a->stack[i] != b->stack[i] ) {
+            printf( "\tStack[%d]: %03x != %03x\n", i, a->stack[i], b->stack[i] );
+        }
+    }
+    if ( a->delayTimer != b->delayTimer ) {
+        printf( "\tDelay Timer: %u != %u\n", a->delayTimer, b->delayTimer );
+    }
+    if ( a->soundTimer != b->soundTimer ) {
+        printf( "\tSound Timer: %u != %u\n", a->soundTimer, b->soundTimer );
+    }
+    if ( a->keyBlocked != b->keyBlocked ) {
+        printf( "\tKey Blocked: %d != %d\n", a->keyBlocked, b->keyBlocked );
+    }
+    if ( a->randomState != b->randomState ) {
+        printf( "\tRandom State: %08x != %08x\n", a->randomState, b->randomState );
+    }
+    int lines = 0;
+    for ( int i = 0; i < BYTES_MEMORY && lines < MAX_DIFF_LINES; ++i ) {
+        if ( a->memory[i] != b->memory[i] ) {
+            printf( "\tMemory[%03x]: %02x != %02x\n", i, a->memory[i], b->memory[i] );
+            lines++;
+        }
+    }
+    lines = 0;
+    for ( int x = 0; x < DISPLAY_WIDTH; ++x ) {
+        for ( int y = 0; y < DISPLAY_HEIGHT && lines < MAX_DIFF_LINES; ++y ) {
+            if ( a->display[x][y] != b->display[x][y] ) {
+                printf( "\tDisplay[%d][%d]: %d != %d\n", x, y,
+                        a->display[x][y], b->display[x][y] );
+                lines++;
+            }
+        }
+    }
+}
+
+static struct Chip8* lockstep_copy( const struct Chip8 *chip ) {
+    struct Chip8 *copy = malloc( sizeof( struct Chip8 ) );
+    if ( !copy ) {
+        fprintf( stderr, "Could not create new struct Chip8\n" );
+        exit( 1 );
+    }
+    memcpy( copy, chip, sizeof( struct Chip8 ) );
+    return copy;
+}
+
+/*
+ * Step both chips once, ticking their timers at frame boundaries. Returns
+ * false instead if either chip can't safely run its next instruction.
+ */
+static bool lockstep_step( struct Chip8 *reference, struct Chip8 *candidate,
+                           const struct Backend *referenceBackend,
+                           const struct Backend *candidateBackend,
+                           uint64_t *instruction ) {
+    if ( reference->keyBlocked || candidate->keyBlocked ||
+         !lockstep_isSafe( reference ) || !lockstep_isSafe( candidate ) ) {
+        return false;
+    }
+    referenceBackend->step( reference );
+    candidateBackend->step( candidate );
+    ++*instruction;
+    uint32_t instructionsPerFrame = reference->instructionsPerSecond /
+                                    reference->framesPerSecond;
+    if ( *instruction % instructionsPerFrame == 0 ) {
+        ch8_tickTimers( reference );
+        ch8_tickTimers( candidate );
+    }
+    return true;
+}
+
+bool lockstep_run( const struct Chip8 *chip, const struct Backend *reference,
+                   const struct Backend *candidate, uint64_t maxInstructions,
+                   uint32_t blockSize, uint64_t *instructionsRun ) {
+    struct Chip8 *referenceChip = lockstep_copy( chip );
+    struct Chip8 *candidateChip = lockstep_copy( chip );
+    struct Chip8 *referenceStart = lockstep_copy( chip );
+    struct Chip8 *candidateStart = lockstep_copy( chip );
+    uint64_t instruction = 0;
+    bool matched = true;
+    bool running = true;
+    if ( blockSize == 0 ) {
+        blockSize = 1;
+    }
+
+    while ( running && instruction < maxInstructions ) {
+        uint64_t blockStart = instruction;
+        memcpy( referenceStart, referenceChip, sizeof( struct Chip8 ) );
+        memcpy( candidateStart, candidateChip, sizeof( struct Chip8 ) );
+        for ( uint32_t i = 0; i < blockSize && instruction < maxInstructions; ++i ) {
+            if ( !lockstep_step( referenceChip, candidateChip, reference,
+                                 candidate, &instruction ) ) {
+                running = false;
+                break;
+            }
+        }
+        if ( lockstep_sameState( referenceChip, candidateChip ) ) {
+            continue;
+        }
+
+        //rewind to the start of the block and find the exact instruction
+        memcpy( referenceChip, referenceStart, sizeof( struct Chip8 ) );
+        memcpy( candidateChip, candidateStart, sizeof( struct Chip8 ) );
+        instruction = blockStart;
+        uint16_t programCounter = referenceChip->programCounter;
+        uint16_t opcode = 0;
+        while ( lockstep_sameState( referenceChip, candidateChip ) ) {
+            programCounter = referenceChip->programCounter;
+            opcode = referenceChip->memory[programCounter] << 8 |
+                     referenceChip->memory[programCounter + 1];
+            if ( !lockstep_step( referenceChip, candidateChip, reference,
+                                 candidate, &instruction ) ) {
+                break;
+            }
+        }
+        printf( "Divergence after %llu instructions, at %03x (instruction %04x)\n",
+                ( unsigned long long ) instruction, programCounter, opcode );
+        printf( "%s != %s:\n", reference->name, candidate->name );
+        lockstep_printDiff( referenceChip, candidateChip );
+        matched = false;
+        break;
+    }
+
+    if ( instructionsRun ) {
+        *instructionsRun = instruction;
+    }
+    free( referenceChip );
+    free( candidateChip );
+    free( referenceStart );
+    free( candidateStart );
+    return matched;
+}
+
+static uint32_t lockstep_random( uint32_t *state ) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*
+ * A random opcode that is a real instruction, so the sub-operations of the
+ * 8XYN, EXNN and FXNN families get picked as often as the rest. FX0A ends the
+ * run, so it only shows up rarely.
+ */
+static uint16_t lockstep_randomOpcode( uint32_t *state ) {
+    static const uint8_t arithmetic[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+    static const uint8_t keys[] = { 0x9E, 0xA1 };
+    static const uint8_t misc[] = { 0x07, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65 };
+    uint32_t value = lockstep_random( state );
+    uint16_t family = value >> 28;
+    uint16_t operands = value & 0x0FFF;
+    uint32_t choice = ( value >> 12 ) & 0xFFFF;
+    switch ( family ) {
+        case 0x0:
+            return choice % 3 == 0 ? 0x00E0 : choice % 3 == 1 ? 0x00EE : operands;
+        case 0x8:
+            return 0x8000 | ( operands & 0x0FF0 ) |
+                   arithmetic[choice % sizeof( arithmetic )];
+        case 0xE:
+            return 0xE000 | ( operands & 0x0F00 ) | keys[choice % sizeof( keys )];
+        case 0xF:
+            if ( choice % 64 == 0 ) {
+                return 0xF00A | ( operands & 0x0F00 );
+            }
+            return 0xF000 | ( operands & 0x0F00 ) | misc[choice % sizeof( misc )];
+    }
+    return family << 12 | operands;
+}
+
+bool lockstep_fuzz( uint64_t runs, uint64_t instructionsPerRun, uint32_t blockSize,
+                    uint32_t seed, const struct Backend *reference,
+                    const struct Backend *candidate ) {
+    uint32_t state = seed ? seed : 1;
+    uint64_t instructions = 0;
+    struct Chip8 *chip = ch8_initializeHeadless();
+    for ( uint64_t run = 0; run < runs; ++run ) {
+        struct Chip8 fresh = *chip;
+        memset( fresh.memory, 0, sizeof( fresh.memory ) );
+        for ( int i = fresh.startingProgramAddress; i < BYTES_MEMORY; i += 2 ) {
+            uint16_t opcode = lockstep_randomOpcode( &state );
+            fresh.memory[i] = opcode >> 8;
+            fresh.memory[i + 1] = opcode & 0xFF;
+        }
+        for ( int i = 0; i < 16; ++i ) {
+            fresh.registers[i] = lockstep_random( &state );
+        }
+        fresh.indexRegister = lockstep_random( &state ) % BYTES_MEMORY;
+        fresh.delayTimer = lockstep_random( &state );
+        fresh.keys = lockstep_random( &state );
+        ch8_seedRandom( &fresh, lockstep_random( &state ) );
+
+        uint64_t instructionsRun;
+        bool matched = lockstep_run( &fresh, reference, candidate,
+                                     instructionsPerRun, blockSize, &instructionsRun );
+        instructions += instructionsRun;
+        if ( !matched ) {
+            printf( "Fuzz: run %llu of seed %u diverged\n",
+                    ( unsigned long long ) run, seed );
+            free( chip );
+            return false;
+        }
+    }
+    printf( "Fuzz: %llu runs of seed %u matched, %llu instructions\n",
+            ( unsigned long long ) runs, seed, ( unsigned long long ) instructions );
+    free( chip );
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+#include <stdint.h>
+#include "ch8.h"
+
+/*
+ * An execution backend, anything that can run one instruction of a Chip8
+ *
+ * @member name name used to pick the backend from the command line
+ * @member step fetch and execute one instruction, same contract as ch8_step
+ */
+struct Backend {
+    const char *name;
+    void ( *step )( struct Chip8 *chip );
+};
+
+/*
+ * Find a backend by name
+ *
+ * "reference" is ch8_step, every other backend is checked against it.
+ *
+ * @param name name of the backend
+ * @return the backend, or NULL if there is none with that name
+ */
+const struct Backend* lockstep_findBackend( const char *name );
+
+/*
+ * Whether the next instruction can run without tripping one of the asserts in
+ * the backends or touching memory past the end, since both backends would take
+ * the whole process down with them.
+ *
+ * @param chip Chip8 about to run its next instruction
+ * @return true if the instruction is safe to run
+ */
+bool lockstep_isSafe( const struct Chip8 *chip );
+
+/*
+ * Run two backends side by side on copies of the same chip
+ *
+ * The architectural state (registers, index, program counter, stack, timers,
+ * random state, memory, display and key blocking) of both copies is compared
+ * every blockSize instructions. When a block differs, both copies are rewound
+ * to the start of the block and stepped one instruction at a time, so the
+ * diff printed is for the first instruction that went wrong. Timers are ticked
+ * once every instructionsPerSecond / framesPerSecond instructions.
+ *
+ * The run also stops (without a divergence) if the chip waits on a key or is
+ * about to run an instruction that would trip an assert or go out of memory.
+ *
+ * @param chip            Chip8 to start from, left untouched
+ * @param reference       backend that is trusted
+ * @param candidate       backend being checked
+ * @param maxInstructions instructions to run at most
+ * @param blockSize       instructions between compares, 1 for every one
+ * @param instructionsRun set to the instructions run by each backend, can be
+ *                        NULL
+ * @return whether the backends matched for the whole run
+ */
+bool lockstep_run( const struct Chip8 *chip, const struct Backend *reference,
+                   const struct Backend *candidate, uint64_t maxInstructions,
+                   uint32_t blockSize, uint64_t *instructionsRun );
+
+/*
+ * Drive lockstep_run with randomly generated programs
+ *
+ * Every run gets fresh memory filled with opcodes from every instruction
+ * family (with random operands), random registers/index and a random seed.
+ * Stops at the first divergence.
+ *
+ * @param runs                 programs to generate
+ * @param instructionsPerRun   instructions to run each program for
+ * @param blockSize            instructions between compares, 1 for every one
+ * @param seed                 seed for the program generator
+ * @param reference            backend that is trusted
+ * @param candidate            backend being checked
+ * @return whether every run matched
+ */
+bool lockstep_fuzz( uint64_t runs, uint64_t instructionsPerRun, uint32_t blockSize,
+                    uint32_t seed, const struct Backend *reference,
+                    const struct Backend *candidate );
+
+#endif
@@ -2,15 +2,440 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
 #include "ch8.h"
+#include "capture.h"
+#include "lockstep.h"
+#include "gdbstub.h"
+#include "runahead.h"
+#include "governor.h"
+#include "latency.h"
+#include "host.h"
+#include "corpus.h"
+#include "checkpoint.h"
+
+#define MAX_SNAPSHOT_FRAMES 1024
+
+/*
+ * Everything that can be set from the command line
+ *
+ * @member romPath        program to load
+ * @member headless       run without a window, as fast as possible
+ * @member frames         frames to run for when headless, 0 for no limit
+ * @member y4mPath        file to capture a Y4M stream to
+ * @member pngDirectory   directory to capture PNG snapshots to
+ * @member snapshotFrames frames to take PNG snapshots of
+ * @member snapshotCount  number of elements in snapshotFrames
+ * @member lockstep       backend to check against the reference, NULL for none
+ * @member lockstepBlock  instructions between lockstep compares
+ * @member fuzzRuns       random programs to check the lockstep backend with
+ * @member seed           seed for the fuzzer, corpus and headless runs
+ * @member gdbAddress     port or Unix socket path for the gdb stub, NULL for none
+ * @member runAheadFrames frames to run ahead of the input, 0 for off
+ * @member speed          instructionsPerSecond to start at, 0 for the default
+ * @member governor       whether to adjust the speed while running
+ * @member governorMode   how the governor picks the speed
+ * @member minSpeed       lowest speed the governor will pick
+ * @member maxSpeed       highest speed the governor will pick
+ * @member latencyStats   whether to track input latency and frame jitter
+ * @member statsInterval  seconds between latency stats dumps, 0 for on exit
+ * @member hostPath       Unix socket to serve sessions on, NULL to run one chip
+ * @member threads        threads the host runs sessions on
+ * @member corpusPath     directory of ROMs to analyze and run, NULL for none
+ * @member cachePath      directory corpus results are cached in
+ * @member checkpointPath file to checkpoint a headless run to, NULL for none
+ * @member checkpointInterval frames between checkpoints
+ * @member resume         whether to start from the checkpoint
+ */
+struct Options {
+    const char *romPath;
+    bool headless;
+    uint64_t frames;
+    const char *y4mPath;
+    const char *pngDirectory;
+    uint64_t snapshotFrames[MAX_SNAPSHOT_FRAMES];
+    int snapshotCount;
+    const char *lockstep;
+    uint32_t lockstepBlock;
+    uint64_t fuzzRuns;
+    uint32_t seed;
+    const char *gdbAddress;
+    uint32_t runAheadFrames;
+    uint32_t speed;
+    bool governor;
+    enum GovernorMode governorMode;
+    uint32_t minSpeed;
+    uint32_t maxSpeed;
+    bool latencyStats;
+    double statsInterval;
+    const char *hostPath;
+    uint32_t threads;
+    const char *corpusPath;
+    const char *cachePath;
+    const char *checkpointPath;
+    uint64_t checkpointInterval;
+    bool resume;
+};
+
+//set by SIGINT/SIGTERM, so a checkpointed run can stop at a frame boundary
+static volatile sig_atomic_t stopRequested = 0;
+
+static void printUsage( const char *program ) {
+    fprintf( stderr,
+             "Usage: %s [options] [rom]\n"
+             "  --headless              run without a window, as fast as possible\n"
+             "  --frames N              stop a headless run after N frames\n"
+             "  --capture-y4m PATH      write every frame to a Y4M stream (can be a fifo)\n"
+             "  --capture-png DIR       write PNG snapshots of --snapshot-frames to DIR\n"
+             "  --snapshot-frames LIST  comma separated frame numbers, starting at 0\n"
+             "  --lockstep BACKEND      check BACKEND against the reference for --frames\n"
+             "  --lockstep-block N      instructions between lockstep compares\n"
+             "  --fuzz RUNS             check the lockstep backend with random programs\n"
+             "  --seed N                seed for --fuzz, --corpus and --headless runs\n"
+             "  --gdb PORT|PATH         serve the gdb remote protocol on a local port or\n"
+             "                          Unix socket\n"
+             "  --run-ahead N           show frames emulated N frames ahead to cut input\n"
+             "                          latency (headless: only measures the cost)\n"
+             "  --speed N               instructions per second to start at\n"
+             "  --governor MODE         adjust the speed to the ROM, MODE is interactive\n"
+             "                          or throughput (batch runs)\n"
+             "  --min-speed N           lowest speed the governor will pick\n"
+             "  --max-speed N           highest speed the governor will pick\n"
+             "  --latency-stats         print input latency, frame and timer jitter\n"
+             "                          histograms on exit\n"
+             "  --stats-interval SECS   also print them every SECS seconds\n"
+             "  --host PATH             serve sessions of the ROM to clients of a Unix\n"
+             "                          socket, instead of opening a window\n"
+             "  --threads N             threads the host runs sessions on\n"
+             "  --corpus DIR            analyze and run every .ch8 in DIR for --frames\n"
+             "                          (default 600), reusing cached results\n"
+             "  --cache DIR             where --corpus keeps its cache\n"
+             "  --checkpoint PATH       checkpoint a headless run to PATH, and on exit\n"
+             "  --checkpoint-interval N frames between checkpoints\n"
+             "  --resume                start from the --checkpoint if there is one\n",
+             program );
+}
+
+static void parseSnapshotFrames( struct Options *options, char *list ) {
+    for ( char *frame = strtok( list, "," ); frame; frame = strtok( NULL, "," ) ) {
+        if ( options->snapshotCount == MAX_SNAPSHOT_FRAMES ) {
+            fprintf( stderr, "Too many snapshot frames, max is %d\n",
+                     MAX_SNAPSHOT_FRAMES );
+            exit( 1 );
+        }
+        options->snapshotFrames[options->snapshotCount++] = strtoull( frame, NULL, 10 );
+    }
+}
+
+static void parseOptions( struct Options *options, int argc, char *argv[] ) {
+    memset( options, 0, sizeof( struct Options ) );
+    options->romPath = "roms/test_opcode.ch8";
+    options->lockstepBlock = 1;
+    options->seed = 1;
+    options->minSpeed = 350;
+    options->maxSpeed = 14000;
+    options->threads = 4;
+    options->cachePath = ".chip8cache";
+    options->checkpointInterval = 3600;
+    for ( int i = 1; i < argc; ++i ) {
+        bool hasValue = i + 1 < argc;
+        if ( !strcmp( argv[i], "--headless" ) ) {
+            options->headless = true;
+        } else if ( !strcmp( argv[i], "--frames" ) && hasValue ) {
+            options->frames = strtoull( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--capture-y4m" ) && hasValue ) {
+            options->y4mPath = argv[++i];
+        } else if ( !strcmp( argv[i], "--capture-png" ) && hasValue ) {
+            options->pngDirectory = argv[++i];
+        } else if ( !strcmp( argv[i], "--snapshot-frames" ) && hasValue ) {
+            parseSnapshotFrames( options, argv[++i] );
+        } else if ( !strcmp( argv[i], "--lockstep" ) && hasValue ) {
+            options->lockstep = argv[++i];
+        } else if ( !strcmp( argv[i], "--lockstep-block" ) && hasValue ) {
+            options->lockstepBlock = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--fuzz" ) && hasValue ) {
+            options->fuzzRuns = strtoull( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--seed" ) && hasValue ) {
+            options->seed = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--gdb" ) && hasValue ) {
+            options->gdbAddress = argv[++i];
+        } else if ( !strcmp( argv[i], "--run-ahead" ) && hasValue ) {
+            options->runAheadFrames = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--speed" ) && hasValue ) {
+            options->speed = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--governor" ) && hasValue ) {
+            options->governor = true;
+            ++i;
+            if ( !strcmp( argv[i], "throughput" ) ) {
+                options->governorMode = GOVERNOR_THROUGHPUT;
+            } else if ( !strcmp( argv[i], "interactive" ) ) {
+                options->governorMode = GOVERNOR_INTERACTIVE;
+            } else {
+                printUsage( argv[0] );
+                exit( 1 );
+            }
+        } else if ( !strcmp( argv[i], "--min-speed" ) && hasValue ) {
+            options->minSpeed = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--max-speed" ) && hasValue ) {
+            options->maxSpeed = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--latency-stats" ) ) {
+            options->latencyStats = true;
+        } else if ( !strcmp( argv[i], "--stats-interval" ) && hasValue ) {
+            options->latencyStats = true;
+            options->statsInterval = strtod( argv[++i], NULL );
+        } else if ( !strcmp( argv[i], "--host" ) && hasValue ) {
+            options->hostPath = argv[++i];
+        } else if ( !strcmp( argv[i], "--threads" ) && hasValue ) {
+            options->threads = strtoul( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--corpus" ) && hasValue ) {
+            options->corpusPath = argv[++i];
+        } else if ( !strcmp( argv[i], "--cache" ) && hasValue ) {
+            options->cachePath = argv[++i];
+        } else if ( !strcmp( argv[i], "--checkpoint" ) && hasValue ) {
+            options->checkpointPath = argv[++i];
+        } else if ( !strcmp( argv[i], "--checkpoint-interval" ) && hasValue ) {
+            options->checkpointInterval = strtoull( argv[++i], NULL, 10 );
+        } else if ( !strcmp( argv[i], "--resume" ) ) {
+            options->resume = true;
+        } else if ( argv[i][0] != '-' ) {
+            options->romPath = argv[i];
+        } else {
+            printUsage( argv[0] );
+            exit( 1 );
+        }
+    }
+}
+
+/*
+ * Which key of the hex keypad a keyboard key is, laid out as
+ *  1 2 3 C     1 2 3 4
+ *  4 5 6 D  =  Q W E R
+ *  7 8 9 E     A S D F
+ *  A 0 B F     Z X C V
+ *
+ * @return the hex key, or -1 if the keyboard key isn't on the keypad
+ */
+static int keyForScancode( SDL_Scancode scancode ) {
+    switch ( scancode ) {
+        case SDL_SCANCODE_1: return 0x1;
+        case SDL_SCANCODE_2: return 0x2;
+        case SDL_SCANCODE_3: return 0x3;
+        case SDL_SCANCODE_4: return 0xC;
+        case SDL_SCANCODE_Q: return 0x4;
+        case SDL_SCANCODE_W: return 0x5;
+        case SDL_SCANCODE_E: return 0x6;
+        case SDL_SCANCODE_R: return 0xD;
+        case SDL_SCANCODE_A: return 0x7;
+        case SDL_SCANCODE_S: return 0x8;
+        case SDL_SCANCODE_D: return 0x9;
+        case SDL_SCANCODE_F: return 0xE;
+        case SDL_SCANCODE_Z: return 0xA;
+        case SDL_SCANCODE_X: return 0x0;
+        case SDL_SCANCODE_C: return 0xB;
+        case SDL_SCANCODE_V: return 0xF;
+        default: return -1;
+    }
+}
+
+static void requestStop( int signum ) {
+    ( void ) signum;
+    stopRequested = 1;
+}
+
+/*
+ * Run without a Screen, one frame at a time with no waiting in between, until
+ * the frame limit is hit. The debugger (if any) is serviced between frames,
+ * and waited on for as long as it has the chip stopped.
+ *
+ * With a Checkpoint the run is checkpointed every checkpointInterval frames,
+ * SIGINT/SIGTERM stop it at the next frame, and a last checkpoint is written
+ * however it stops. The frame limit counts the frames before startFrame.
+ */
+static void runHeadless( struct Chip8 *chip, struct Options *options,
+                         struct Capture *capture, struct Governor *governor,
+                         struct Checkpoint *checkpoint, uint64_t startFrame ) {
+    uint64_t frame = startFrame;
+    if ( checkpoint ) {
+        signal( SIGINT, requestStop );
+        signal( SIGTERM, requestStop );
+    }
+    while ( ( !options->frames || frame < options->frames ) && !stopRequested ) {
+        if ( chip->debugger ) {
+            gdbstub_poll( chip->debugger, chip, 0 );
+            while ( !gdbstub_isRunning( chip->debugger ) && !stopRequested ) {
+                gdbstub_poll( chip->debugger, chip, 100 );
+            }
+            if ( stopRequested ) {
+                break; //still checkpointed below, stopped by gdb or not
+            }
+        }
+        if ( !ch8_runFrame( chip ) ) {
+            continue; //stopped partway through by the debugger
+        }
+        frame++;
+        if ( governor ) {
+            governor_endFrame( governor, chip );
+        }
+        if ( chip->runAhead ) {
+            runahead_speculate( chip->runAhead, chip );
+        }
+        if ( capture ) {
+            capture_submitFrame( capture, chip );
+        }
+        if ( checkpoint && options->checkpointInterval &&
+             frame % options->checkpointInterval == 0 ) {
+            checkpoint_submit( checkpoint, &chip, 1, governor, frame );
+        }
+    }
+    if ( checkpoint ) {
+        checkpoint_flush( checkpoint );
+        checkpoint_submit( checkpoint, &chip, 1, governor, frame );
+        fprintf( stderr, "Stopped at frame %llu\n", ( unsigned long long ) frame );
+    }
+}
+
+/*
+ * Free everything hanging off the chip, and the chip itself
+ */
+static void freeChip( struct Chip8 *chip, struct Capture *capture,
+                      struct Governor *governor, struct Checkpoint *checkpoint ) {
+    if ( checkpoint ) {
+        checkpoint_close( checkpoint );
+    }
+    if ( governor ) {
+        governor_close( governor, chip );
+    }
+    if ( capture ) {
+        capture_close( capture );
+    }
+    if ( chip->debugger ) {
+        gdbstub_close( chip->debugger );
+    }
+    if ( chip->runAhead ) {
+        runahead_printStats( chip->runAhead, chip->framesPerSecond );
+        runahead_free( chip->runAhead );
+    }
+    if ( chip->latency ) {
+        latency_printStats( chip->latency );
+        latency_free( chip->latency );
+    }
+    free( chip );
+}
+
+/*
+ * Check the --lockstep backend against the reference, either on the ROM or on
+ * --fuzz random programs.
+ *
+ * @return exit code, 0 if the backends matched
+ */
+static int runLockstep( struct Options *options ) {
+    const struct Backend *reference = lockstep_findBackend( "reference" );
+    const struct Backend *candidate = lockstep_findBackend( options->lockstep );
+    if ( !candidate ) {
+        fprintf( stderr, "Unknown backend %s\n", options->lockstep );
+        return 1;
+    }
+    if ( options->fuzzRuns ) {
+        return !lockstep_fuzz( options->fuzzRuns, 10000, options->lockstepBlock,
+                               options->seed, reference, candidate );
+    }
+
+    struct Chip8 *chip = ch8_initializeHeadless();
+    ch8_initializeFonts( chip, 0x50 );
+    ch8_loadFileIntoMemory( chip, options->romPath );
+    uint64_t frames = options->frames ? options->frames : 600;
+    uint64_t instructions;
+    bool matched = lockstep_run( chip, reference, candidate,
+                                 frames * chip->instructionsPerSecond /
+                                 chip->framesPerSecond,
+                                 options->lockstepBlock, &instructions );
+    if ( matched ) {
+        printf( "Lockstep: %llu instructions matched (%s == %s)\n",
+                ( unsigned long long ) instructions, reference->name,
+                candidate->name );
+    }
+    free( chip );
+    return !matched;
+}
 
 int main( int argc, char *argv[] ) {
 
-    srand( ( unsigned ) time(NULL) );
+    struct Options options;
+    parseOptions( &options, argc, argv );
+    if ( options.lockstep ) {
+        return runLockstep( &options );
+    }
+    if ( options.corpusPath ) {
+        return corpus_run( options.corpusPath, options.cachePath,
+                           options.frames ? options.frames : 600, options.speed,
+                           options.seed );
+    }
+    if ( options.hostPath ) {
+        return host_run( options.hostPath, options.romPath, options.threads,
+                         options.speed );
+    }
 
-    struct Chip8 *chip = ch8_initialize();
+    struct Chip8 *chip = options.headless ? ch8_initializeHeadless() :
+                                            ch8_initialize();
     ch8_initializeFonts( chip, 0x50 );
-    ch8_loadFileIntoMemory( chip, "roms/test_opcode.ch8" );
+    ch8_loadFileIntoMemory( chip, options.romPath );
+    //headless runs are repeatable, windowed ones get a new game every time
+    ch8_seedRandom( chip, options.headless ? options.seed :
+                                             ( uint32_t ) time( NULL ) );
+
+    if ( options.gdbAddress ) {
+        chip->debugger = gdbstub_initialize( options.gdbAddress );
+    }
+    if ( options.runAheadFrames ) {
+        chip->runAhead = runahead_initialize( options.runAheadFrames );
+    }
+    if ( options.speed ) {
+        chip->instructionsPerSecond = options.speed;
+        chip->secondsPerInstruction = 1.0 / options.speed;
+    }
+    if ( options.latencyStats && !options.headless ) {
+        chip->latency = latency_initialize( chip->framesPerSecond,
+                                            options.statsInterval );
+    }
+    struct Governor *governor = NULL;
+    if ( options.governor ) {
+        governor = governor_initialize( options.governorMode, options.minSpeed,
+                                        options.maxSpeed, options.romPath );
+    }
+
+    struct Capture *capture = NULL;
+    if ( options.y4mPath || options.pngDirectory ) {
+        capture = capture_initialize( options.y4mPath, options.pngDirectory,
+                                      options.snapshotFrames,
+                                      options.snapshotCount,
+                                      chip->framesPerSecond );
+    }
+
+    if ( options.headless ) {
+        struct Checkpoint *checkpoint = NULL;
+        uint64_t startFrame = 0;
+        if ( options.checkpointPath ) {
+            uint64_t programHash = checkpoint_programHash( chip );
+            if ( options.resume && access( options.checkpointPath, F_OK ) ) {
+                fprintf( stderr, "No checkpoint at %s yet, starting from frame 0\n",
+                         options.checkpointPath );
+            } else if ( options.resume ) {
+                if ( !checkpoint_restore( options.checkpointPath, &chip, 1, governor,
+                                          programHash, &startFrame ) ) {
+                    exit( 1 );
+                }
+                fprintf( stderr, "Resuming from frame %llu\n",
+                         ( unsigned long long ) startFrame );
+            }
+            checkpoint = checkpoint_initialize( options.checkpointPath, programHash );
+        }
+        runHeadless( chip, &options, capture, governor, checkpoint, startFrame );
+        freeChip( chip, capture, governor, checkpoint );
+        return 0;
+    }
+
     ch8_dumpMemory( chip );
 
     //Test program, just drawing 0 at the top left of the screen
@@ -24,8 +449,9 @@ int main( int argc, char *argv[] ) {
     //memory[0x207] = 0x06;
 
     SDL_Event e;
+    bool running = true;
 
-    while ( 1 ) {
+    while ( running ) {
         /*
          * If STEP is 1, the program will hang up here with every step of the
          * chip, until the user presses any button. This also allows for the
@@ -37,7 +463,9 @@ int main( int argc, char *argv[] ) {
             if ( SDL_PollEvent( &e ) > 0 ) {
                 switch ( e.type ) {
                     case SDL_QUIT:
-                        exit( 1 );
+                        running = false;
+                        step = 0;
+                        break;
                     case SDL_KEYUP:
                         step = 0;
                         break;
@@ -47,29 +475,60 @@ int main( int argc, char *argv[] ) {
 
         //this is in case STEP is 0, still allowing user to quit
         while ( SDL_PollEvent( &e ) > 0 ) {
+            int key;
+            if ( chip->latency && ( e.type == SDL_KEYDOWN || e.type == SDL_KEYUP ) &&
+                 keyForScancode( e.key.keysym.scancode ) >= 0 ) {
+                latency_keyEvent( chip->latency );
+            }
             switch ( e.type ) {
                 case SDL_KEYDOWN:
-                    chip->keyPressed = true;
-                    printf( "%i\n", e.key.keysym.scancode );
-                    printf( "%i\n", e.key.keysym.sym );
+                    key = keyForScancode( e.key.keysym.scancode );
+                    if ( key >= 0 ) {
+                        ch8_setKeys( chip, chip->keys | 1 << key );
+                    }
                     break;
                 case SDL_KEYUP:
-                    chip->keyPressed = false;
+                    key = keyForScancode( e.key.keysym.scancode );
+                    if ( key >= 0 ) {
+                        ch8_setKeys( chip, chip->keys & ~( 1 << key ) );
+                    }
                     break;
                 case SDL_QUIT:
-                    exit( 1 );
+                    running = false;
                     break;
             }
             //ch8_drawScreen( chip );
         }
 
-        ch8_updateScreen( chip );
-        ch8_drawScreen( chip );
+        //the chip (and its timers) stand still while gdb has it stopped
+        if ( chip->debugger && !gdbstub_isRunning( chip->debugger ) ) {
+            gdbstub_poll( chip->debugger, chip, 10 );
+            continue;
+        }
+
+        if ( ch8_drawScreen( chip ) ) {
+            if ( governor ) {
+                governor_endFrame( governor, chip );
+            }
+            if ( capture ) {
+                capture_submitFrame( capture, chip );
+            }
+            if ( chip->debugger ) {
+                gdbstub_poll( chip->debugger, chip, 0 );
+            }
+        }
+
+        if ( chip->debugger && gdbstub_isWatching( chip->debugger ) ) {
+            if ( ch8_instructionDue( chip ) ) {
+                gdbstub_step( chip->debugger, chip );
+            }
+            continue;
+        }
         //fetch
         ch8_fetchNextInstruction( chip ); 
         //decode
         ch8_decodeAndExecuteCurrentInstruction( chip );
     }
-    free( chip );
+    freeChip( chip, capture, governor, NULL );
     return 0;
 }
@@ -0,0 +1,66 @@
+#include "runahead.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double runahead_seconds() {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+struct RunAhead* runahead_initialize( uint32_t frames ) {
+    struct RunAhead *runAhead = malloc( sizeof( struct RunAhead ) );
+    if ( !runAhead ) {
+        fprintf( stderr, "Could not create new struct RunAhead\n" );
+        exit( 1 );
+    }
+    memset( runAhead, 0, sizeof( struct RunAhead ) );
+    runAhead->frames = frames;
+    runAhead->speculative = malloc( sizeof( struct Chip8 ) );
+    if ( !runAhead->speculative ) {
+        fprintf( stderr, "Could not create new struct Chip8\n" );
+        exit( 1 );
+    }
+    return runAhead;
+}
+
+struct Chip8* runahead_speculate( struct RunAhead *runAhead, struct Chip8 *chip ) {
+    double start = runahead_seconds();
+    struct Chip8 *speculative = runAhead->speculative;
+    memcpy( speculative, chip, sizeof( struct Chip8 ) );
+    speculative->screen = NULL;
+    speculative->debugger = NULL;
+    speculative->runAhead = NULL;
+    for ( uint32_t i = 0; i < runAhead->frames; ++i ) {
+        ch8_runFrame( speculative );
+    }
+    speculative->screen = chip->screen;
+
+    double elapsed = runahead_seconds() - start;
+    runAhead->presented++;
+    runAhead->totalSeconds += elapsed;
+    if ( elapsed > runAhead->maxSeconds ) {
+        runAhead->maxSeconds = elapsed;
+    }
+    return speculative;
+}
+
+void runahead_printStats( struct RunAhead *runAhead, uint32_t framesPerSecond ) {
+    if ( !runAhead->presented ) {
+        return;
+    }
+    double average = runAhead->totalSeconds / runAhead->presented;
+    fprintf( stderr, "Run-ahead: %u frames ahead, %llu frames, %.2f us/frame "
+                     "(max %.2f us, %.3f%% of a frame), saves %.1f ms of latency\n",
+             runAhead->frames, ( unsigned long long ) runAhead->presented,
+             average * 1e6, runAhead->maxSeconds * 1e6,
+             average * framesPerSecond * 100,
+             runAhead->frames * 1000.0 / framesPerSecond );
+}
+
+void runahead_free( struct RunAhead *runAhead ) {
+    free( runAhead->speculative );
+    free( runAhead );
+}
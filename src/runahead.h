@@ -0,0 +1,66 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+#include <stdint.h>
+#include "ch8.h"
+
+/*
+ * Run-ahead: every presented frame is emulated some frames into the future
+ * with the keys that are held right now, so a key press shows up that many
+ * frames sooner.
+ *
+ * The real chip is snapshotted by copying it into a scratch Chip8, the copy
+ * is run ahead headless and thrown away, which is the same as restoring the
+ * snapshot but without a second copy. Everything the copy could change lives
+ * in struct Chip8 (random state included), so the real chip never notices.
+ *
+ * @member frames       frames to emulate ahead
+ * @member speculative  scratch chip that is run ahead
+ * @member presented    frames that were run ahead
+ * @member totalSeconds time spent snapshotting and running ahead
+ * @member maxSeconds   longest time spent on one frame
+ */
+struct RunAhead {
+    uint32_t frames;
+    struct Chip8 *speculative;
+    uint64_t presented;
+    double totalSeconds;
+    double maxSeconds;
+};
+
+/*
+ * Create a RunAhead
+ *
+ * @param frames frames to emulate ahead, each one is about 1/framesPerSecond
+ *               of latency saved
+ * @return newly created RunAhead
+ */
+struct RunAhead* runahead_initialize( uint32_t frames );
+
+/*
+ * Snapshot a chip and run the copy ahead
+ *
+ * The copy has no Screen or debugger while it runs, so it never beeps or stops
+ * on a breakpoint.
+ *
+ * @param runAhead RunAhead to use
+ * @param chip     Chip8 to run ahead of, left untouched
+ * @return the chip as it will be frames from now, valid until the next call
+ */
+struct Chip8* runahead_speculate( struct RunAhead *runAhead, struct Chip8 *chip );
+
+/*
+ * Print the time spent running ahead and the latency it saves
+ *
+ * @param runAhead        RunAhead to print the stats of
+ * @param framesPerSecond frame rate of the chip that was run ahead
+ */
+void runahead_printStats( struct RunAhead *runAhead, uint32_t framesPerSecond );
+
+/*
+ * Free a RunAhead
+ *
+ * @param runAhead RunAhead to free
+ */
+void runahead_free( struct RunAhead *runAhead );
+
+#endif
@@ -0,0 +1,133 @@
+#include "scaler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//4 pixels at a time, aligned to a single pixel so runs can start anywhere.
+//GCC lowers this to whatever the target has (SSE2, NEON, ...)
+typedef uint32_t scaler_vec __attribute__(( vector_size( 16 ), aligned( 4 ), may_alias ));
+#define SCALER_VEC_PIXELS 4
+
+static void *scaler_allocate( size_t bytes ) {
+    void *buffer = malloc( bytes );
+    if ( !buffer ) {
+        fprintf( stderr, "Could not allocate scaler buffer\n" );
+        exit( 1 );
+    }
+    return buffer;
+}
+
+static void scaler_fill( uint32_t *dest, uint32_t color, int count ) {
+    scaler_vec colors = { color, color, color, color };
+    int i = 0;
+    for ( ; i + SCALER_VEC_PIXELS <= count; i += SCALER_VEC_PIXELS ) {
+        *( scaler_vec* )( dest + i ) = colors;
+    }
+    for ( ; i < count; ++i ) {
+        dest[i] = color;
+    }
+}
+
+//halve every color channel, leaving alpha alone
+static void scaler_dim( uint32_t *dest, const uint32_t *src, int count ) {
+    const scaler_vec mask = { 0x007F7F7F, 0x007F7F7F, 0x007F7F7F, 0x007F7F7F };
+    const scaler_vec alpha = { 0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000 };
+    int i = 0;
+    for ( ; i + SCALER_VEC_PIXELS <= count; i += SCALER_VEC_PIXELS ) {
+        scaler_vec pixels = *( const scaler_vec* )( src + i );
+        *( scaler_vec* )( dest + i ) = ( ( pixels >> 1 ) & mask ) | alpha;
+    }
+    for ( ; i < count; ++i ) {
+        dest[i] = ( ( src[i] >> 1 ) & 0x007F7F7F ) | 0xFF000000;
+    }
+}
+
+static uint32_t scaler_blend( uint32_t background, uint32_t foreground,
+                              int intensity ) {
+    uint32_t color = 0xFF000000;
+    for ( int shift = 0; shift < 24; shift += 8 ) {
+        int back = ( background >> shift ) & 0xFF;
+        int fore = ( foreground >> shift ) & 0xFF;
+        int channel = back + ( fore - back ) * intensity / 255;
+        color |= ( uint32_t ) channel << shift;
+    }
+    return color;
+}
+
+struct Scaler* scaler_initialize( int windowWidth, int windowHeight,
+                                  int displayWidth, int displayHeight,
+                                  uint32_t foreground, uint32_t background ) {
+    struct Scaler *scaler = scaler_allocate( sizeof( struct Scaler ) );
+    memset( scaler, 0, sizeof( struct Scaler ) );
+
+    int pixelWidth = windowWidth / displayWidth;
+    int pixelHeight = windowHeight / displayHeight;
+    int pixelSize = pixelWidth < pixelHeight ? pixelWidth : pixelHeight;
+
+    scaler->width = windowWidth;
+    scaler->height = windowHeight;
+    scaler->displayWidth = displayWidth;
+    scaler->displayHeight = displayHeight;
+    scaler->pixelSize = pixelSize;
+    scaler->xOffset = ( windowWidth - pixelSize * displayWidth ) / 2;
+    scaler->yOffset = ( windowHeight - pixelSize * displayHeight ) / 2;
+    scaler->foreground = foreground;
+    scaler->background = background;
+
+    scaler->pixels = scaler_allocate( sizeof( uint32_t ) * windowWidth * windowHeight );
+    scaler->row = scaler_allocate( sizeof( uint32_t ) * pixelSize * displayWidth );
+    scaler->dimRow = scaler_allocate( sizeof( uint32_t ) * pixelSize * displayWidth );
+    scaler->intensity = scaler_allocate( displayWidth * displayHeight );
+    memset( scaler->intensity, 0, displayWidth * displayHeight );
+    scaler_fill( scaler->pixels, background, windowWidth * windowHeight );
+
+    for ( int i = 0; i < 256; ++i ) {
+        scaler->palette[i] = scaler_blend( background, foreground, i );
+    }
+    return scaler;
+}
+
+void scaler_setFilters( struct Scaler *scaler, float decay, bool scanlines ) {
+    scaler->decay = decay < 0 ? 0 : decay > 1 ? 1 : decay;
+    scaler->scanlines = scanlines;
+}
+
+void scaler_render( struct Scaler *scaler, const bool *display ) {
+    const int pixelSize = scaler->pixelSize;
+    const int rowPixels = pixelSize * scaler->displayWidth;
+    //decay in 1/256ths so the per pixel work stays in integers
+    const int keep = scaler->decay * 256;
+
+    for ( int y = 0; y < scaler->displayHeight; ++y ) {
+        uint8_t *intensity = scaler->intensity + y * scaler->displayWidth;
+        for ( int x = 0; x < scaler->displayWidth; ++x ) {
+            if ( display[x * scaler->displayHeight + y] ) {
+                intensity[x] = 255;
+            } else {
+                intensity[x] = intensity[x] * keep >> 8;
+            }
+            scaler_fill( scaler->row + x * pixelSize,
+                         scaler->palette[intensity[x]], pixelSize );
+        }
+        if ( scaler->scanlines ) {
+            scaler_dim( scaler->dimRow, scaler->row, rowPixels );
+        }
+
+        int outputY = scaler->yOffset + y * pixelSize;
+        uint32_t *dest = scaler->pixels + outputY * scaler->width + scaler->xOffset;
+        for ( int i = 0; i < pixelSize; ++i ) {
+            const uint32_t *src = scaler->scanlines && ( ( outputY + i ) & 1 ) ?
+                                  scaler->dimRow : scaler->row;
+            memcpy( dest, src, sizeof( uint32_t ) * rowPixels );
+            dest += scaler->width;
+        }
+    }
+}
+
+void scaler_free( struct Scaler *scaler ) {
+    free( scaler->pixels );
+    free( scaler->row );
+    free( scaler->dimRow );
+    free( scaler->intensity );
+    free( scaler );
+}
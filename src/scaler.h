@@ -0,0 +1,101 @@
+#ifndef SCALER_H
+#define SCALER_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Software output stage that turns the chip's display into a window sized
+ * ARGB8888 buffer, so the cost of drawing does not depend on how fast the
+ * SDL renderer backend is at drawing lots of small rectangles.
+ *
+ * Scaling is nearest-neighbour by a whole number (pixelSize), centered in the
+ * window the same way screen_initialize centers the rectangles. Every output
+ * row of a display row is identical, so a row is only expanded once and then
+ * copied down for the rest of the pixel block.
+ *
+ * @member pixels     ARGB8888 output, width * height, rows are width long
+ * @member width      width of the output buffer in pixels
+ * @member height     height of the output buffer in pixels
+ * @member xOffset    offset from left/right side
+ * @member yOffset    offset from top/bottom side
+ * @member pixelSize  width/height of each display pixel in the output
+ * @member foreground ARGB color of a lit pixel
+ * @member background ARGB color of an unlit pixel (and the border)
+ * @member decay      how much of a pixel's brightness is kept every frame after
+ *                    it is turned off, 0 to disable phosphor blending
+ * @member scanlines  whether every other output row is drawn at half brightness
+ * @member intensity  phosphor brightness (0-255) of every display pixel, stored
+ *                    row by row
+ * @member palette    ARGB color for every intensity
+ * @member row        scratch space for one expanded output row
+ * @member dimRow     scratch space for one expanded, dimmed output row
+ * @member displayWidth  width of the chip's display
+ * @member displayHeight height of the chip's display
+ */
+struct Scaler {
+    uint32_t *pixels;
+    int width;
+    int height;
+    int xOffset;
+    int yOffset;
+    int pixelSize;
+    uint32_t foreground;
+    uint32_t background;
+    float decay;
+    bool scanlines;
+    uint8_t *intensity;
+    uint32_t palette[256];
+    uint32_t *row;
+    uint32_t *dimRow;
+    int displayWidth;
+    int displayHeight;
+};
+
+/*
+ * Create a scaler for a window of the given size
+ *
+ * The whole output buffer is filled with the background once here, only the
+ * area the display is scaled into is touched by scaler_render.
+ *
+ * @param windowWidth   width of the output buffer
+ * @param windowHeight  height of the output buffer
+ * @param displayWidth  width of the chip's display
+ * @param displayHeight height of the chip's display
+ * @param foreground    ARGB color of a lit pixel
+ * @param background    ARGB color of an unlit pixel
+ * @return newly created Scaler
+ */
+struct Scaler* scaler_initialize( int windowWidth, int windowHeight,
+                                  int displayWidth, int displayHeight,
+                                  uint32_t foreground, uint32_t background );
+
+/*
+ * Set the CRT style filters
+ *
+ * @param scaler    Scaler to change
+ * @param decay     brightness kept per frame by pixels that were turned off
+ *                  (0.0 - 1.0), 0 turns phosphor blending off
+ * @param scanlines whether to darken every other output row
+ */
+void scaler_setFilters( struct Scaler *scaler, float decay, bool scanlines );
+
+/*
+ * Scale a display into the output buffer
+ *
+ * The display is laid out the same way as Chip8::display, so it is indexed
+ * display[x * displayHeight + y]. Should be called once per presented frame,
+ * since the phosphor decay is applied on every call.
+ *
+ * @param scaler  Scaler holding the output buffer
+ * @param display pixel data, whether each pixel is on or off
+ */
+void scaler_render( struct Scaler *scaler, const bool *display );
+
+/*
+ * Free a scaler and its buffers
+ *
+ * @param scaler Scaler to free
+ */
+void scaler_free( struct Scaler *scaler );
+
+#endif
@@ -26,18 +26,25 @@ struct Screen* screen_initialize( int windowWidth, int windowHeight ) {
         exit( 1 );
     }
     SDL_RenderClear( screen->renderer );
-    
-    int pixelWidth = windowWidth / DISPLAY_WIDTH;
-    int pixelHeight = windowHeight / DISPLAY_HEIGHT;
-    int pixelSize = pixelWidth < pixelHeight ? pixelWidth : pixelHeight;
-    int displayWidth = pixelSize * DISPLAY_WIDTH;
-    int displayHeight = pixelSize * DISPLAY_HEIGHT;
-    int displayXOffset = ( windowWidth - displayWidth ) / 2;
-    int displayYOffset = ( windowHeight   - displayHeight ) / 2;
 
-    screen->pixelSize = pixelSize;
-    screen->xOffset = displayXOffset;
-    screen->yOffset = displayYOffset;
+    screen->texture = SDL_CreateTexture( screen->renderer,
+                                         SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_STREAMING,
+                                         windowWidth, windowHeight );
+    if ( !screen->texture ) {
+        fprintf( stderr, "Could not create texture\n" );
+        exit( 1 );
+    }
+    screen->scaler = scaler_initialize( windowWidth, windowHeight,
+                                        DISPLAY_WIDTH, DISPLAY_HEIGHT,
+                                        PIXEL_COLOR, BACKGROUND_COLOR );
+    scaler_setFilters( screen->scaler, PHOSPHOR_DECAY, SCANLINES );
+    
+    screen->width = windowWidth;
+    screen->height = windowHeight;
+    screen->pixelSize = screen->scaler->pixelSize;
+    screen->xOffset = screen->scaler->xOffset;
+    screen->yOffset = screen->scaler->yOffset;
 
     return screen;
 }
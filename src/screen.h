@@ -1,15 +1,24 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 #include <SDL2/SDL.h>
+#include "scaler.h"
 #define DISPLAY_WIDTH 64  //pixels, standard is 64
 #define DISPLAY_HEIGHT 32 //pixels, standard is 32
+#define PIXEL_COLOR 0xFFFF0000      //ARGB of a lit pixel
+#define BACKGROUND_COLOR 0xFF000000 //ARGB of an unlit pixel
+#define PHOSPHOR_DECAY 0.0 //brightness a pixel keeps per frame after turning off,
+                           //0 to disable, ~0.6 hides most flicker
+#define SCANLINES 0 //whether to darken every other row of the window
 
 /*
  * Holds all of the relevant information about a screen. Screens are used
  * to display the pixel data on.
  *
  * @member window    SDL window to draw to
- * @member renderer  SDL renderer that holds the drawn rectangles
+ * @member renderer  SDL renderer that the texture is copied to
+ * @member texture   streaming texture the size of the window, holds the
+ *                   output of scaler
+ * @member scaler    software scaler that fills the texture from the display
  * @member xOffset   offset from left/right side
  * @member yOffset   offset from top/bottom side
  * @member pixelSize width/height of each pixel
@@ -17,6 +26,8 @@
 struct Screen {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    struct Scaler *scaler;
     int width;
     int height;
     int xOffset;
@@ -28,8 +39,8 @@ struct Screen {
  * Initialize a screen for use by chip8
  *
  * This function will also initialize SDL. After that, it will create a window
- * (680px X 480px), create the needed renderer, and determine the size of the
- * square to represent each pixel.
+ * (680px X 480px), create the needed renderer and texture, and determine the
+ * size of the square to represent each pixel.
  *
  * @return newly created Screen
  */